@@ -1,3 +1,3 @@
 @echo off
-gcc -g -o dsgraph -std=gnu99 -O3 -mno-ms-bitfields -Iinclude -Llib src/dsgraph.c src/model.c src/fs.c src/heap.c src/io.c src/texture_containers.c src/pickup_models.c src/rooms.c src/error.c src/os.c src/room.c src/entity.c src/jumppad.c src/teleporter.c src/object.c src/item.c src/door.c src/platform.c src/forcefield.c src/artifact.c src/lzss.c src/archive.c src/utils.c src/strings.c src/scan.c src/hud.c src/game.c src/world.c src/animation.c src/mtx.c src/vec.c -lopengl32 -lglu32 -lfreeglut -lm
+gcc -g -o dsgraph -std=gnu99 -O3 -mno-ms-bitfields -Iinclude -Llib src/dsgraph.c src/model.c src/bake.c src/meshopt.c src/cull.c src/bvh.c src/occlusion.c src/texdecode.c src/texcache.c src/glstate.c src/fs.c src/heap.c src/io.c src/texture_containers.c src/pickup_models.c src/rooms.c src/error.c src/os.c src/room.c src/entity.c src/jumppad.c src/teleporter.c src/object.c src/item.c src/door.c src/platform.c src/forcefield.c src/artifact.c src/lzss.c src/archive.c src/hash.c src/worker.c src/loader.c src/utils.c src/strings.c src/scan.c src/hud.c src/game.c src/world.c src/animation.c src/mtx.c src/vec.c -lopengl32 -lglu32 -lfreeglut -lm -lpthread
 cv2pdb -C dsgraph.exe
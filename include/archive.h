@@ -1,7 +1,13 @@
 #ifndef __ARCHIVE_H__
 #define __ARCHIVE_H__
 
+#include "io.h"
+
+void SetArchiveCacheDir(const char* dir);
 void LoadArchive(const char* name, const char* filename);
+void LoadArchiveAsync(const char* name, const char* filename);
 int LoadFromArchive(void** out, const char* name, const char* filename);
+int BorrowFromArchive(void** out, const char* name, const char* filename);
+int StampFromArchive(FileStamp* stamp, const char* name, const char* filename);
 
 #endif
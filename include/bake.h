@@ -0,0 +1,13 @@
+#ifndef __BAKE_H__
+#define __BAKE_H__
+
+#include "model.h"
+#include "io.h"
+
+void	SetModelBakeDir(const char* dir);
+/* the baked CModel_parse result for the stamped source, NULL if there is
+   none or it is stale; the source only needs reading on a miss, see bake.c */
+CModel*	CModel_find_baked(const char* name, const FileStamp* scene, const FileStamp* textures, int layer_mask);
+void	CModel_store_baked(const char* name, const FileStamp* scene, const FileStamp* textures, int layer_mask, const CModel* model);
+
+#endif
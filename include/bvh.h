@@ -0,0 +1,36 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include "types.h"
+
+typedef struct {
+	float		bounds[3][2];
+	int		node_id;
+	int		mesh_id;
+} BVHItem;
+
+typedef struct {
+	float		bounds[3][2];
+	unsigned int	first;		/* items of the whole subtree are items[first .. first + count) */
+	unsigned int	count;
+	unsigned int	right;		/* inner nodes: index of the right child, the left one follows; 0 = leaf */
+} BVHNode;
+
+typedef struct {
+	BVHNode*	nodes;
+	unsigned int	num_nodes;
+	BVHItem*	items;
+	unsigned int	num_items;
+} BVH;
+
+typedef void (*BVHVisitFunc)(const BVHItem* item, void* arg);
+
+/* SAH build, the items are copied and reordered */
+BVH*	BVH_build(const BVHItem* items, unsigned int count);
+void	BVH_free(BVH* bvh);
+/* calls func for every item inside the view frustum, see cull.h */
+void	BVH_cull(const BVH* bvh, BVHVisitFunc func, void* arg);
+/* closest item whose box the ray hits, -1 if none; *t is the distance along dir */
+int	BVH_raycast(const BVH* bvh, const float origin[3], const float dir[3], float* t);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __CULL_H__
+#define __CULL_H__
+
+#include "types.h"
+
+typedef struct {
+	unsigned int	submitted;	/* meshes added to the render list */
+	unsigned int	frustum_culled;	/* meshes rejected by CULLTestBounds */
+	unsigned int	portal_culled;	/* room meshes in cells no portal reaches */
+	unsigned int	occluded;	/* meshes rejected by OCCLTestBounds */
+} CullStats;
+
+#define	CULL_OUTSIDE	0
+#define	CULL_INTERSECT	1
+#define	CULL_INSIDE	2
+
+extern CullStats cull_stats;
+extern bool frustum_culling;
+
+/* extracts the clip planes of projection * view, resets the stats */
+void	CULLBeginFrame(const Mtx44* projection, const Mtx44* view);
+/* where a world space box lies relative to the view frustum */
+int	CULLClassifyBounds(const float bounds[3][2]);
+/* FALSE if the world space box is completely outside the view frustum */
+bool	CULLTestBounds(const float bounds[3][2]);
+/* NDC rectangle x0, y0, x1, y1 a world space box covers on screen */
+void	CULLProjectBounds(const float bounds[3][2], float rect[4]);
+
+#endif
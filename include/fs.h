@@ -39,6 +39,12 @@ typedef enum {
 	FS_SEEK_END
 } FSSeekFileMode;
 
+/* PC only */
+typedef enum {
+	FS_MAP_READ,	/* read-only view, shared with the page cache */
+	FS_MAP_COPY	/* writable private view, pages are copied on first write */
+} FSMapMode;
+
 struct FSFile;
 typedef struct FSFile FSFile;
 
@@ -94,6 +100,12 @@ BOOL	FS_CloseFile(FSFile* p_file);
 int	FS_ReadFile(FSFile* p_file, void* dst, int len);
 BOOL	FS_SeekFile(FSFile *p_file, s32 offset, FSSeekFileMode origin);
 
+/* PC only */
+BOOL	FS_OpenHostFile(FSFile* p_file, const char* path);
+u64	FS_GetModifiedTime(FSFile* p_file);
+void*	FS_MapFile(FSFile* p_file, FSMapMode mode);
+void	FS_UnmapFile(void* ptr, u32 len);
+
 /* internal */
 BOOL	FSi_SendCommand(FSFile *p_file, FSCommandType command);
 
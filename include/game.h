@@ -24,6 +24,7 @@ extern Mtx44 view_inv_xyrot;
 extern StringTable game_messages;
 extern StringTable location_names;
 
+void GAMEPreloadRoom(int room_id);
 void GAMEInit();
 void GAMESetRoom(int room_id, unsigned int layer_mask);
 void GAMERenderScene(float aspect);
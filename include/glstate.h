@@ -0,0 +1,51 @@
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#include <GL/gl.h>
+
+#include "types.h"
+
+typedef struct {
+	unsigned int	calls;		/* state changes asked for this frame */
+	unsigned int	skipped;	/* of those, no-ops that never reached GL */
+} GLStateStats;
+
+extern GLStateStats gl_state_stats;
+
+/* forgets the GL state, which other code may have changed since the last
+   frame, and resets the stats; call before the first draw of a frame */
+void	GLSBeginFrame(void);
+/* leaves texture unit 0 active for the code that does not use the cache */
+void	GLSEndFrame(void);
+
+void	GLSUseProgram(GLuint program);
+void	GLSBindTexture(unsigned int unit, GLuint tex);
+/* TRUE if the binding changed, vertex attribute pointers need setting up again */
+bool	GLSBindBuffer(GLenum target, GLuint buffer);
+
+/* GL_CULL_FACE, GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_ALPHA_TEST,
+   GL_LIGHTING and GL_POLYGON_OFFSET_FILL are cached, others passed on */
+void	GLSEnable(GLenum cap, bool enable);
+void	GLSCullFace(GLenum mode);
+void	GLSDepthFunc(GLenum func);
+void	GLSDepthMask(GLboolean flag);
+void	GLSColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+void	GLSStencilFunc(GLenum func, GLint ref, GLuint mask);
+void	GLSStencilOp(GLenum fail, GLenum zfail, GLenum zpass);
+void	GLSStencilMask(GLuint mask);
+void	GLSAlphaFunc(GLenum func, GLclampf ref);
+void	GLSBlendFunc(GLenum sfactor, GLenum dfactor);
+void	GLSBlendFuncSeparate(GLenum srgb, GLenum drgb, GLenum salpha, GLenum dalpha);
+void	GLSPolygonOffset(GLfloat factor, GLfloat units);
+/* GL_FRONT material colours, four floats */
+void	GLSMaterialfv(GLenum pname, const GLfloat* params);
+
+/* uniforms of the current program, forgotten when another one is made current */
+void	GLSUniform1i(GLint location, GLint v);
+void	GLSUniform1f(GLint location, GLfloat v);
+void	GLSUniform2f(GLint location, GLfloat x, GLfloat y);
+void	GLSUniform3fv(GLint location, GLsizei count, const GLfloat* v);
+void	GLSUniform4fv(GLint location, GLsizei count, const GLfloat* v);
+void	GLSUniformMatrix4fv(GLint location, GLsizei count, const GLfloat* v);
+
+#endif
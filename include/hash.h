@@ -0,0 +1,19 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include "types.h"
+
+u64	fnv1a64(const void* data, u32 len);
+
+/* zlib compatible CRC-32, the fastest path the CPU has; any thread */
+u32	crc32(const void* data, u32 len);
+/* continues crc (0 to start) over more data */
+u32	crc32_update(u32 crc, const void* data, u32 len);
+
+/* the paths crc32 picks from, for benchmarks; crc32_clmul falls back to
+   the tables when crc32_clmul_supported is FALSE */
+u32	crc32_table(u32 crc, const void* data, u32 len);
+u32	crc32_clmul(u32 crc, const void* data, u32 len);
+bool	crc32_clmul_supported(void);
+
+#endif
@@ -5,4 +5,18 @@ void* alloc_from_heap(unsigned int size);
 void free_to_heap(void* ptr);
 void check_heap();
 
+/* bump allocator for data that is all dropped at once */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+	ArenaBlock*	blocks;		/* newest first */
+	unsigned int	used;		/* bytes handed out since the last reset */
+	unsigned int	high_water;	/* most bytes used between two resets */
+} Arena;
+
+/* 16 byte aligned, valid until the next reset_arena */
+void* alloc_from_arena(Arena* arena, unsigned int size);
+/* drops everything; what a reset ever had to hold is kept as one block */
+void reset_arena(Arena* arena);
+
 #endif
@@ -3,7 +3,21 @@
 
 #include "fs.h"
 
+/* identifies file contents without reading them, for cache keys */
+typedef struct {
+	u64	mtime;		/* of the file, or of the archive it is in */
+	u32	size;		/* of the file, or of the compressed archive */
+	u32	offset;		/* of the entry in the decoded archive, 0 for files */
+	u32	length;		/* of the file or entry */
+	u32	reserved;
+} FileStamp;
+
 int LoadFile(void** out, const char* filename);
 int LoadFileFromArchive(void** out, const char* filename);
+int BorrowFileFromArchive(void** out, const char* filename);
+int MapFile(void** out, const char* filename, FSMapMode mode);
+void UnmapFile(void* ptr, int size);
+int StampFile(FileStamp* stamp, const char* filename);
+int StampFileInArchive(FileStamp* stamp, const char* filename);
 
 #endif
@@ -0,0 +1,18 @@
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include "model.h"
+
+typedef void (*ModelReadyFunc)(CModel* model, void* arg);
+
+/* Parses the model on a worker thread. *model stays NULL until the model
+ * has been uploaded by process_async_loads, then ready(model, arg) is called
+ * on the main thread. Requests for a model that is already loaded call ready
+ * right away, requests for a model that is still pending only add ready. */
+void	load_model_async(CModel** model, const char* filename, int flags, ModelReadyFunc ready, void* arg);
+/* uploads finished models, call once per frame from the GL thread */
+void	process_async_loads(void);
+/* waits for and uploads all pending models */
+void	finish_async_loads(void);
+
+#endif
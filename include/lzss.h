@@ -1,6 +1,6 @@
 #ifndef __LZSS_H__
 #define __LZSS_H__
 
-int LZDecode(void** out, void* in);
+int LZDecode(void** out, const void* in, int in_size);
 
 #endif
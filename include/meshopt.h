@@ -0,0 +1,16 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include "model.h"
+
+typedef struct {
+	unsigned int	vertices_in;
+	unsigned int	vertices_out;
+	unsigned int	triangles_in;
+	unsigned int	triangles_out;
+} MeshOptStats;
+
+/* welds duplicate vertices, drops degenerate triangles and reorders for the vertex cache; adds to stats */
+void	optimize_geometry(CGeometry* geo, MeshOptStats* stats);
+
+#endif
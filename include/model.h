@@ -2,6 +2,8 @@
 #define __MODEL_H__
 
 #include "types.h"
+#include "texcache.h"
+#include "heap.h"
 
 typedef enum {
 	LAYER_ML0	= 0x0008,
@@ -108,6 +110,7 @@ typedef struct {
 	Mtx44				node_transform;
 	float				offset;
 	fx32				offset_raw;
+	float				bounds[3][2];	/* meshes in model space, see CModel_update_node_bounds */
 } CNode;
 
 typedef struct {
@@ -188,19 +191,60 @@ typedef struct {
 	GXTexGen			texgen_mode;
 	int				matrix_id;
 	int				anim_flags;
+	/* texture state decoded by CModel_parse, consumed by CModel_upload */
+	u32*				image;		/* RGBA, or the palette and then the indices */
+	bool				translucent;
+	bool				indexed;	/* tex holds palette indices */
+	unsigned int			palette_tex;
+	TexCacheKey			tex_key;
+	TexCacheEntry*			tex_entry;	/* shared GL texture, see texcache.c */
+	TexCacheEntry*			palette_entry;
+	const void*			entry_owner;	/* the material that took the references, not a copy of it */
+	int				wrap_s;
+	int				wrap_t;
+	int				filter;
 } CMaterial;
 
+/* bytes in the decoded image of a material */
+#define MATERIAL_IMAGE_SIZE(mat, tex)	((mat)->indexed ? 256 * 4 + (tex)->width * (tex)->height : (tex)->width * (tex)->height * 4)
+
 typedef struct {
 	unsigned int			matid;
 	unsigned int			dlistid;
-	float				bounds[3][2];
+	float				bounds[3][2];	/* [axis][min, max] in dlist space */
 } CMesh;
 
+/* display list contents decoded on the CPU */
+#define	VTX_HAS_COLOR			0x1
+#define	VTX_HAS_NORMAL			0x2
+
+typedef struct {
+	float				pos[3];
+	float				uv[3];		/* s, t, matrix id */
+	float				normal[3];
+	float				color[4];
+	unsigned int			flags;
+} CVertex;
+
+typedef struct {
+	CVertex*			vertices;
+	unsigned int			num_vertices;
+	unsigned int*			indices;	/* triangle list */
+	unsigned int			num_indices;
+} CGeometry;
+
+/* range of a display list in the model's index buffer */
+typedef struct {
+	unsigned int			first;
+	unsigned int			count;
+} CDrawRange;
+
 typedef struct {
 	unsigned int			format;
 	unsigned int			width;
 	unsigned int			height;
 	bool				opaque;
+	unsigned int			size;
 	u8*				data;
 } CTexture;
 
@@ -211,11 +255,14 @@ typedef struct {
 
 typedef struct {
 	void*				scenedata;
+	u8*				baked;		/* mapping of a baked model, see bake.c */
+	unsigned int			baked_size;
 
 	CMaterial*			materials;
 	CNode*				nodes;
 	CMesh*				meshes;
-	int*				dlists;
+	CDrawRange*			dlists;		/* per dlist, set by CModel_upload */
+	CGeometry*			geometry;	/* per dlist, NULL after CModel_upload */
 	CTexture*			textures;
 	CPalette*			palettes;
 	unsigned int			num_meshes;
@@ -223,6 +270,9 @@ typedef struct {
 	unsigned int			num_palettes;
 	unsigned int			num_materials;
 	unsigned int			num_dlists;
+	unsigned int			vbo;
+	unsigned int			ibo;
+	int				pos_shift;	/* positions in the vbo are 4.12 >> pos_shift */
 	unsigned int			num_nodes;
 	float				scale;
 	Vec3*				node_pos;
@@ -251,23 +301,37 @@ typedef struct {
 int	get_node_child(const char* name, CModel* scene);
 void	scale_rotate_translate(Mtx44* mtx, float sx, float sy, float sz, float ax, float ay, float az, float x, float y, float z);
 void	CModel_init(void);
+bool	CModel_indexed_textures(void);
 void	CModel_setLights(float l1vec[3], float l1col[3], float l2vec[3], float l2col[3]);
 void	CModel_setFog(bool en, float fogc[4], int fogoffset, int fogslope);
 void	CModel_setFogDisable(bool dis);
 void	load_model(CModel** model, const char* filename, int flags);
 void	load_room_model(CModel** model, const char* filename, const char* txtrfilename, int flags, int layer_mask);
+void	parse_model(CModel** model, const char* filename, int flags);
+void	parse_room_model(CModel** model, const char* filename, const char* txtrfilename, int flags, int layer_mask);
+CModel*	CModel_parse(u8* scenedata, unsigned int scenesize, u8* texturedata, unsigned int texturesize, int layer_mask);
+void	CModel_upload(CModel* model);
 CModel*	CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsigned int texturesize, int layer_mask);
 CModel*	CModel_load_file(const char* model, const char* textures, int layer_mask);
+void	CModel_decode_textures(CModel* model);
 void	CModel_set_textures(CModel* model);
+void	CModel_update_node_bounds(CModel* model);
+void	CModel_get_mesh_bounds(CModel* model, int mesh_id, const Mtx44* transform, float bounds[3][2]);
+void	CModel_get_node_bounds(CModel* model, int node_idx, float bounds[3][2]);
+bool	CModel_mesh_is_occluder(CModel* model, int mesh_id);
+unsigned int	CModel_get_mesh_triangles(CModel* model, int mesh_id, const Mtx44* transform, float* vertices);
 void	CModel_set_texture_filter(CModel* model, int type);
 void	CModel_free(CModel* scene);
 void	CModel_render_all(CModel* scene, Mtx44* mtx, float alpha);
-void	CModel_render_node(CModel* scene, Mtx44* mtx, int node_idx, float alpha);
+void	CModel_render_node_mesh(CModel* scene, Mtx44* mtx, int node_idx, int mesh_id, float alpha);
 void	CModel_compute_node_matrices(CModel* model, int start_idx);
 
 void	CModel_begin_scene(void);
 void	CModel_end_scene(void);
 
+/* the render list and skinning matrices of the frame, reset by CModel_begin_scene */
+extern Arena frame_arena;
+
 #define TOON_SIZE 32
 
 #define GetTableColor(c) (((c >> 0) & 0x1F) / 31.0f), (((c >> 5) & 0x1F) / 31.0f), (((c >> 10) & 0x1F) / 31.0f)
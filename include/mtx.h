@@ -16,5 +16,6 @@ void MTX44ScaleApply(const Mtx44* src, Mtx44* dst, const float x, const float y,
 void MTX44RotRad(Mtx44* m, const char axis, const float rad);
 void MTX44RotTrig(Mtx44* m, char axis, const float sinA, const float cosA);
 void MTX44ClearRot(const Mtx44* src, Mtx44* dst);
+void MTX44TransformBounds(const Mtx44* m, const float src[3][2], float dst[3][2]);
 
 #endif
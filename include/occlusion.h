@@ -0,0 +1,23 @@
+#ifndef __OCCLUSION_H__
+#define __OCCLUSION_H__
+
+#include "types.h"
+
+/* world space triangles that hide what is behind them, see occlusion.c */
+typedef struct {
+	float		bounds[3][2];
+	float*		vertices;	/* x, y, z per corner, visible side counter-clockwise */
+	unsigned int	num_triangles;
+} COccluder;
+
+extern bool occlusion_culling;
+extern int max_occluders;
+
+/* clears the depth buffer for projection * view */
+void	OCCLBeginFrame(const Mtx44* projection, const Mtx44* view);
+/* rasterizes the occluder into the depth buffer if it is in the frustum */
+void	OCCLRenderOccluder(const COccluder* occluder);
+/* FALSE if the world space box is completely behind the occluders */
+bool	OCCLTestBounds(const float bounds[3][2]);
+
+#endif
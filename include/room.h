@@ -5,9 +5,26 @@
 #include "model.h"
 #include "animation.h"
 #include "rooms.h"
+#include "bvh.h"
+#include "occlusion.h"
 
 typedef struct NodeRef NodeRef;
 
+/* an rm node with its meshes, the unit of portal visibility */
+typedef struct {
+	int			node_id;	/* first child of the rm node */
+	float			bounds[3][2];
+	BVH*			bvh;		/* its meshes in world space */
+	int			num_portals;
+	bool			visible;	/* see WORLDFindVisibleCells */
+} CRoomCell;
+
+/* an opening between two cells, see WORLDBuildCellPortals */
+typedef struct {
+	int			cells[2];
+	float			bounds[3][2];
+} CCellPortal;
+
 typedef struct {
 	char			name[32];
 	int			layer_mask;
@@ -17,6 +34,12 @@ typedef struct {
 	CAnimation*		animation;
 	const RoomDescription*	description;
 	NodeRef*		room_nodes;
+	CRoomCell*		cells;		/* one per room node */
+	int			num_cells;
+	CCellPortal*		portals;
+	int			num_portals;
+	COccluder*		occluders;	/* see build_room_occluders */
+	int			num_occluders;
 } CRoom;
 
 struct NodeRef {
@@ -26,6 +49,7 @@ struct NodeRef {
 
 CRoom*	load_room(const RoomDescription* descr, fx32 x, fx32 y, fx32 z, int layer_mask);
 void	CRoom_render(CRoom* room);
+int	CRoom_pick(CRoom* room, const float origin[3], const float dir[3], int* node_id, float* t);
 void	CRoom_process(CRoom* room, float dt);
 void	CRoom_free(CRoom* room);
 
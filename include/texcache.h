@@ -0,0 +1,46 @@
+#ifndef __TEXCACHE_H__
+#define __TEXCACHE_H__
+
+#include "types.h"
+
+/* what a cached GL texture holds */
+enum {
+	TEXCACHE_RGBA = 0,		/* the decoded image */
+	TEXCACHE_INDICES,		/* one palette index per texel, GL_R8 */
+	TEXCACHE_PALETTE		/* the expanded palette they index, 256x1 RGBA */
+};
+
+/* everything the decoded and uploaded texture depends on, zero the padding */
+typedef struct {
+	u32		texel_hash;
+	u32		palette_hash;
+	u16		format;
+	u16		width;
+	u16		height;
+	u8		opaque;
+	u8		alpha;
+	u8		polygon_mode;
+	u8		wrap_s;
+	u8		wrap_t;
+	u8		filter;
+	u8		type;
+} TexCacheKey;
+
+typedef struct TexCacheEntry TexCacheEntry;
+
+struct TexCacheEntry {
+	TexCacheKey	key;
+	unsigned int	tex;		/* GL texture */
+	bool		translucent;
+	int		refs;
+	TexCacheEntry*	next;
+};
+
+/* a new reference to the texture for key, NULL if there is none; any thread */
+TexCacheEntry*	TEXCacheFind(const TexCacheKey* key);
+/* adds the GL texture decoded for key, the first reference; main thread */
+TexCacheEntry*	TEXCacheAdd(const TexCacheKey* key, unsigned int tex, bool translucent);
+/* drops a reference, the GL texture goes with the last one; main thread */
+void		TEXCacheRelease(TexCacheEntry* entry);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __TEXDECODE_H__
+#define __TEXDECODE_H__
+
+#include "model.h"
+
+/* decodes tex to RGBA8 with the material alpha (0-31) applied, sets translucent
+   if any texel ends up with alpha below 255; FALSE for unsupported formats */
+bool	TEXDecode(u32* image, const CTexture* tex, const CPalette* pal, unsigned int alpha, bool decal, bool* translucent);
+/* splits a palettised tex into one index byte per texel and the 256 entry RGBA8
+   palette they index, with the same alpha handling; FALSE for direct colour */
+bool	TEXDecodeIndexed(u8* indices, u32* palette, const CTexture* tex, const CPalette* pal, unsigned int alpha, bool decal, bool* translucent);
+
+#endif
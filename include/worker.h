@@ -0,0 +1,16 @@
+#ifndef __WORKER_H__
+#define __WORKER_H__
+
+typedef struct Job Job;
+typedef void (*JobFunc)(void* arg);
+
+/* runs func(arg) on a worker thread, the pool is started on first use */
+Job*	WorkerSubmit(JobFunc func, void* arg);
+/* non-blocking, TRUE once func has returned */
+int	WorkerDone(Job* job);
+/* blocks until the job has finished and releases it */
+void	WorkerWait(Job* job);
+/* finishes all queued jobs and stops the worker threads */
+void	WorkerShutdown(void);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef __WORLD_H__
 #define __WORLD_H__
 
+#include "types.h"
+#include "room.h"
+
 typedef struct cportal CPortal;
 
 struct cportal {
@@ -24,4 +27,8 @@ struct room_info {
 void setup_room_portals();
 const char* get_room_name(int room_id);
 
+void	WORLDBuildCellPortals(CRoom* room);
+int	WORLDFindCell(CRoom* room, const float pos[3]);
+void	WORLDFindVisibleCells(CRoom* room, const float eye[3]);
+
 #endif
@@ -216,15 +216,17 @@ void parse_node_animation(CNode* nodes, int node_cnt, CNodeAnimationGroup* anima
 void load_animation(CAnimation** animation, const char* filename, CModel* model, char flags)
 {
 	Animation* raw;
+	int size;
 	if(flags & USE_ARCHIVE)
-		LoadFileFromArchive((void **)&raw, filename);
+		size = BorrowFileFromArchive((void **)&raw, filename);
 	else
-		LoadFile((void **)&raw, filename);
+		size = MapFile((void **)&raw, filename, FS_MAP_READ);
 
 	printf("loading animation %s\n", filename);
 	*animation = parse_animation(raw, model);
 
-	free_to_heap(raw);
+	if(!(flags & USE_ARCHIVE))
+		UnmapFile(raw, size);
 }
 
 void CAnimation_free(CAnimation* animation)
@@ -1,12 +1,24 @@
+#include <stdio.h>
 #include <string.h>
 #include <strings.h>
 
+#ifdef _WIN32
+#include <Windows.h>
+#define getpid()	GetCurrentProcessId()
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
 #include "error.h"
 #include "heap.h"
 #include "io.h"
 #include "archive.h"
 #include "lzss.h"
 #include "endianess.h"
+#include "hash.h"
+#include "fs.h"
+#include "worker.h"
 
 typedef struct {
 	u8	name[32];
@@ -22,76 +34,338 @@ struct Archive {
 	char		name[32];
 	int		entry_count;
 	void*		data;
+	u16*		index;		/* open addressing, entry number + 1, 0 = empty */
+	u32		index_mask;
+	char*		filename;
+	u32		source_size;	/* of the compressed file, see StampFromArchive */
+	u64		source_mtime;
+	Job*		job;		/* pending decode, see LoadArchiveAsync */
 };
 
-static Archive* archives = NULL;
+#define ARCHIVE_BUCKETS	64
 
-Archive* FindArchive(const char* name)
+static Archive* archives[ARCHIVE_BUCKETS];
+
+/* FNV-1a over the lower-cased name, archive names are case-insensitive */
+static u32 hash_name(const char* name)
+{
+	u32 hash = 2166136261u;
+	while(*name) {
+		u8 c = (u8) *name++;
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash;
+}
+
+static Archive* lookup_archive(const char* name)
 {
 	Archive* arc;
-	for(arc = archives; arc; arc = arc->next) {
+	for(arc = archives[hash_name(name) & (ARCHIVE_BUCKETS - 1)]; arc; arc = arc->next) {
 		if(!strcmp(arc->name, name))
 			return arc;
 	}
 	return NULL;
 }
 
-void LoadArchive(const char* name, const char* filename)
+/* waits for the archive if it is still being decoded */
+Archive* FindArchive(const char* name)
+{
+	Archive* arc = lookup_archive(name);
+	if(arc && arc->job) {
+		WorkerWait(arc->job);
+		arc->job = NULL;
+	}
+	return arc;
+}
+
+static void build_index(Archive* archive)
+{
+	int i;
+	u32 size = 16;
+	u8* data = (u8*) archive->data;
+
+	while(size < archive->entry_count * 2)
+		size <<= 1;
+
+	archive->index = (u16*) alloc_from_heap(size * sizeof(u16));
+	memset(archive->index, 0, size * sizeof(u16));
+	archive->index_mask = size - 1;
+
+	for(i = 0; i < archive->entry_count; i++) {
+		ArchiveEntry* entry = (ArchiveEntry*) (data + 32 + i * sizeof(ArchiveEntry));
+		u32 slot = hash_name((const char*) entry->name) & archive->index_mask;
+		while(archive->index[slot])
+			slot = (slot + 1) & archive->index_mask;
+		archive->index[slot] = i + 1;
+	}
+}
+
+static ArchiveEntry* find_entry(Archive* arc, const char* filename)
+{
+	u8* data = (u8*) arc->data;
+	u32 slot = hash_name(filename) & arc->index_mask;
+
+	while(arc->index[slot]) {
+		ArchiveEntry* entry = (ArchiveEntry*) (data + 32 + (arc->index[slot] - 1) * sizeof(ArchiveEntry));
+		if(!strcasecmp((const char*) entry->name, filename))
+			return entry;
+		slot = (slot + 1) & arc->index_mask;
+	}
+	return NULL;
+}
+
+/*
+
+	Decoded archive cache
+
+	With a cache directory set, the decoded SNDFILE image (entry table already
+	byte-swapped) is written to <dir>/<name>.sndcache after the first load.
+	Later runs map that file instead of decompressing the archive again. The
+	header stores the size, modification time and hash of the compressed
+	archive it was built from; any mismatch rebuilds the cache.
+
+*/
+
+#define CACHE_VERSION	1
+
+typedef struct {
+	char	magic[8];
+	u32	version;
+	u32	source_size;
+	u64	source_mtime;
+	u64	source_hash;
+	u32	size;
+	u32	reserved;
+} ArchiveCacheHeader;
+
+static char* cache_dir = NULL;
+
+void SetArchiveCacheDir(const char* dir)
+{
+	cache_dir = strdup(dir);
+#ifdef _WIN32
+	CreateDirectoryA(dir, NULL);
+#else
+	mkdir(dir, 0755);
+#endif
+}
+
+static u8* read_cache(const char* path, const ArchiveCacheHeader* key)
+{
+	FSFile file;
+	ArchiveCacheHeader* header;
+	u32 len;
+
+	FS_InitFile(&file);
+	if(!FS_OpenHostFile(&file, path))
+		return NULL;
+
+	len = FS_GetLength(&file);
+	header = (ArchiveCacheHeader*) FS_MapFile(&file, FS_MAP_READ);
+	FS_CloseFile(&file);
+	if(!header)
+		return NULL;
+
+	if(len < sizeof(ArchiveCacheHeader) ||
+			memcmp(header->magic, key->magic, sizeof(key->magic)) ||
+			header->version != key->version ||
+			header->source_size != key->source_size ||
+			header->source_mtime != key->source_mtime ||
+			header->source_hash != key->source_hash ||
+			len != sizeof(ArchiveCacheHeader) + header->size) {
+		printf("cache %s is stale\n", path);
+		FS_UnmapFile(header, len);
+		return NULL;
+	}
+
+	return (u8*) (header + 1);
+}
+
+static void write_cache(const char* path, const ArchiveCacheHeader* header, const u8* data)
+{
+	char tmp[256];
+	FILE* f;
+
+	/* write to a temporary file first so that concurrent viewers never see a partial cache */
+	if(snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid()) >= (int) sizeof(tmp)) {
+		printf("cache path %s is too long\n", path);
+		return;
+	}
+	f = fopen(tmp, "wb");
+	if(!f) {
+		printf("cannot write cache %s\n", tmp);
+		return;
+	}
+
+	if(fwrite(header, sizeof(ArchiveCacheHeader), 1, f) != 1 ||
+			fwrite(data, 1, header->size, f) != header->size) {
+		printf("cannot write cache %s\n", tmp);
+		fclose(f);
+		remove(tmp);
+		return;
+	}
+	fclose(f);
+
+#ifdef _WIN32
+	remove(path);
+#endif
+	if(rename(tmp, path))
+		remove(tmp);
+}
+
+static void decode_archive(void* arg)
 {
 	int i;
+	u32 size;
+	FSFile file;
 	void* arc = NULL;
-	u8* data;
+	u8* data = NULL;
+	char cache_path[256];
+	ArchiveCacheHeader key;
+	Archive* archive = (Archive*) arg;
+	bool use_cache = false;
+
+	FS_InitFile(&file);
+	if(!FS_OpenFile(&file, archive->filename))
+		fatal_error("LoadArchive: Cannot open file %s!\n", archive->filename);
+	size = FS_GetLength(&file);
+	arc = FS_MapFile(&file, FS_MAP_READ);
+	if(!arc)
+		fatal_error("LoadArchive: Failed to map the file %s!\n", archive->filename);
+	archive->source_size = size;
+	archive->source_mtime = FS_GetModifiedTime(&file);
+
+	/* a path that does not fit just goes without the cache */
+	if(cache_dir)
+		use_cache = snprintf(cache_path, sizeof(cache_path), "%s/%s.sndcache", cache_dir, archive->name) < (int) sizeof(cache_path);
+
+	if(use_cache) {
+		memset(&key, 0, sizeof(key));
+		memcpy(key.magic, "SNDCACHE", 8);
+		key.version = CACHE_VERSION;
+		key.source_size = size;
+		key.source_mtime = archive->source_mtime;
+		key.source_hash = fnv1a64(arc, size);
+		data = read_cache(cache_path, &key);
+	}
+	FS_CloseFile(&file);
+
+	if(data) {
+		printf("using cached archive %s\n", cache_path);
+		FS_UnmapFile(arc, size);
+	} else {
+		key.size = LZDecode((void**)&data, arc, size);
+		FS_UnmapFile(arc, size);
+
+		if(memcmp(data, "SNDFILE", 7))
+			fatal_error("not a valid archive!");
+
+		for(i = 0; i < data[11]; i++) {
+			ArchiveEntry* entry = (ArchiveEntry*) (data + 32 + i * sizeof(ArchiveEntry));
+			entry->size = get32bit_BE((u8*) &entry->size);
+			entry->offset = get32bit_BE((u8*) &entry->offset);
+		}
+
+		if(use_cache)
+			write_cache(cache_path, &key, data);
+	}
+
+	archive->data = data;
+	archive->entry_count = data[11];
+
+	build_index(archive);
+}
+
+static Archive* register_archive(const char* name, const char* filename)
+{
+	int bucket = hash_name(name) & (ARCHIVE_BUCKETS - 1);
+	Archive* archive = (Archive*) alloc_from_heap(sizeof(Archive));
+
+	printf("registering archive %s\n", name);
+
+	strcpy(archive->name, name);
+	archive->filename = strdup(filename);
+	archive->data = NULL;
+	archive->entry_count = 0;
+	archive->index = NULL;
+	archive->source_size = 0;
+	archive->source_mtime = 0;
+	archive->job = NULL;
+
+	archive->next = archives[bucket];
+	archives[bucket] = archive;
+	return archive;
+}
 
+void LoadArchive(const char* name, const char* filename)
+{
 	Archive* archive = FindArchive(name);
 	if(archive)
 		return;
 
-	printf("registering archive %s\n", name);
+	archive = register_archive(name, filename);
+	decode_archive(archive);
+}
 
-	LoadFile(&arc, filename);
-	LZDecode((void**)&data, arc);
-	free_to_heap(arc);
+/* decodes the archive on a worker thread, the first FindArchive waits for it */
+void LoadArchiveAsync(const char* name, const char* filename)
+{
+	Archive* archive = lookup_archive(name);
+	if(archive)
+		return;
 
-	if(memcmp(data, "SNDFILE", 7))
-		fatal_error("not a valid archive!");
+	archive = register_archive(name, filename);
+	archive->job = WorkerSubmit(decode_archive, archive);
+}
 
-	archive = (Archive*) alloc_from_heap(sizeof(Archive));
-	strcpy(archive->name, name);
-	archive->next = archives;
-	archive->data = data;
-	archive->entry_count = data[11];
+/* returns a pointer into the archive itself, which must be neither modified nor freed */
+int BorrowFromArchive(void** out, const char* name, const char* filename)
+{
+	Archive* arc = FindArchive(name);
+	ArchiveEntry* entry;
 
-	for(i = 0; i < archive->entry_count; i++) {
-		ArchiveEntry* entry = (ArchiveEntry*) (data + 32 + i * sizeof(ArchiveEntry));
-		entry->size = get32bit_BE((u8*) &entry->size);
-		entry->offset = get32bit_BE((u8*) &entry->offset);
-	}
+	if(!arc)
+		fatal_error("BorrowFromArchive: Cannot find archive %s!\n", name);
 
-	archives = archive;
+	entry = find_entry(arc, filename);
+	if(!entry)
+		fatal_error("BorrowFromArchive: Cannot find file %s in archive %s\n", filename, name);
+
+	*out = (u8*) arc->data + entry->offset;
+	return entry->size;
 }
 
-int LoadFromArchive(void** out, const char* name, const char* filename)
+/* the archive file and where the entry is in it, the entry is not read */
+int StampFromArchive(FileStamp* stamp, const char* name, const char* filename)
 {
-	int i;
 	Archive* arc = FindArchive(name);
-	u8* data;
+	ArchiveEntry* entry;
 
 	if(!arc)
-		fatal_error("LoadFromArchive: Cannot find archive %s!\n", name);
+		fatal_error("StampFromArchive: Cannot find archive %s!\n", name);
 
-	data = (u8*) arc->data;
+	entry = find_entry(arc, filename);
+	if(!entry)
+		fatal_error("StampFromArchive: Cannot find file %s in archive %s\n", filename, name);
 
-	for(i = 0; i < arc->entry_count; i++) {
-		ArchiveEntry* entry = (ArchiveEntry*) (data + 32 + i * sizeof(ArchiveEntry));
-		if(!strcasecmp(entry->name, filename)) {
-			int size = entry->size;
-			*out = alloc_from_heap(size);
-			if(!*out)
-				fatal_error("LoadFromArchive: Not enough memory to allocate %d bytes!\n", size);
-			memcpy(*out, data + entry->offset, size);
-			return size;
-		}
-	}
+	memset(stamp, 0, sizeof(FileStamp));
+	stamp->mtime = arc->source_mtime;
+	stamp->size = arc->source_size;
+	stamp->offset = entry->offset;
+	stamp->length = entry->size;
+	return entry->size;
+}
+
+int LoadFromArchive(void** out, const char* name, const char* filename)
+{
+	void* data;
+	int size = BorrowFromArchive(&data, name, filename);
 
-	fatal_error("LoadFromArchive: Cannot find file %s in archive %s\n", filename, name);
+	*out = alloc_from_heap(size);
+	if(!*out)
+		fatal_error("LoadFromArchive: Not enough memory to allocate %d bytes!\n", size);
+	memcpy(*out, data, size);
+	return size;
 }
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#define getpid()	GetCurrentProcessId()
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#include "types.h"
+#include "error.h"
+#include "fs.h"
+#include "model.h"
+#include "bake.h"
+
+/*
+
+	Baked models
+
+	A baked model is the result of CModel_parse written to disk as-is: the
+	CModel structure followed by its material, node, mesh, texture, palette
+	and geometry arrays and the decoded RGBA images. Every pointer is stored
+	as an offset from the start of the file (0 = NULL), so loading it is a
+	private mapping of the file plus a pass that turns the offsets back into
+	pointers. The arrays stay in the mapping, CModel_free knows about that.
+
+	Layouts are those of the build that wrote the file, the header records
+	the structure sizes and any mismatch just rebuilds the file. The key is
+	the FileStamp of the model (and external texture) data, size and
+	modification time of the file or of the archive plus the entry's place
+	in it, so a hit never reads the source. Also the layer mask it was
+	parsed with and whether palettised images were kept as indices
+	(CModel_indexed_textures), which the GL context decides.
+
+*/
+
+#define BAKE_VERSION	8
+#define BAKE_ALIGN	16
+
+typedef struct {
+	char	magic[8];
+	u32	version;
+	u32	pointer_size;
+	u32	model_size;
+	u32	material_size;
+	u32	node_size;
+	u32	vertex_size;
+	u32	layer_mask;
+	u32	indexed;
+	FileStamp	scene;
+	FileStamp	textures;
+	u32	size;
+	u32	reserved;
+} BakedHeader;
+
+typedef struct {
+	u8*	data;
+	u32	size;
+	u32	max_size;
+} BakeBuffer;
+
+static char* bake_dir = NULL;
+
+/* models are parsed on the worker pool, each write gets its own temporary file */
+static pthread_mutex_t tmp_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int tmp_count = 0;
+
+void SetModelBakeDir(const char* dir)
+{
+	bake_dir = strdup(dir);
+#ifdef _WIN32
+	CreateDirectoryA(dir, NULL);
+#else
+	mkdir(dir, 0755);
+#endif
+}
+
+/* appends data and returns its offset */
+static uintptr_t put(BakeBuffer* buf, const void* data, u32 size)
+{
+	u32 ofs = (buf->size + BAKE_ALIGN - 1) & ~(BAKE_ALIGN - 1);
+
+	if(!data || !size)
+		return 0;
+
+	if(ofs + size > buf->max_size) {
+		while(ofs + size > buf->max_size)
+			buf->max_size = buf->max_size ? buf->max_size * 2 : 64 * 1024;
+		buf->data = (u8*) realloc(buf->data, buf->max_size);
+		if(!buf->data)
+			fatal_error("bake: Not enough memory!\n");
+	}
+
+	memset(buf->data + buf->size, 0, ofs - buf->size);
+	memcpy(buf->data + ofs, data, size);
+	buf->size = ofs + size;
+	return ofs;
+}
+
+#define OFS(ptr)	((void*) (ptr))
+#define PTR(base, ofs)	((ofs) ? (void*) ((base) + (uintptr_t) (ofs)) : NULL)
+
+static void bake_model(BakeBuffer* buf, const CModel* model)
+{
+	CModel m = *model;
+	unsigned int i;
+	uintptr_t model_ofs = put(buf, &m, sizeof(CModel));
+
+	if(model->materials) {
+		CMaterial* materials = (CMaterial*) malloc(model->num_materials * sizeof(CMaterial));
+		memcpy(materials, model->materials, model->num_materials * sizeof(CMaterial));
+		for(i = 0; i < model->num_materials; i++) {
+			CMaterial* mat = &materials[i];
+			CTexture* tex = &model->textures[mat->texid];
+			mat->tex = 0;
+			mat->palette_tex = 0;
+			mat->tex_entry = NULL;
+			mat->palette_entry = NULL;
+			mat->entry_owner = NULL;
+			mat->image = mat->image ? OFS(put(buf, mat->image, MATERIAL_IMAGE_SIZE(mat, tex))) : NULL;
+		}
+		m.materials = OFS(put(buf, materials, model->num_materials * sizeof(CMaterial)));
+		free(materials);
+	}
+
+	if(model->textures) {
+		CTexture* textures = (CTexture*) malloc(model->num_textures * sizeof(CTexture));
+		memcpy(textures, model->textures, model->num_textures * sizeof(CTexture));
+		for(i = 0; i < model->num_textures; i++)
+			textures[i].data = OFS(put(buf, textures[i].data, textures[i].size));
+		m.textures = OFS(put(buf, textures, model->num_textures * sizeof(CTexture)));
+		free(textures);
+	}
+
+	if(model->palettes) {
+		CPalette* palettes = (CPalette*) malloc(model->num_palettes * sizeof(CPalette));
+		memcpy(palettes, model->palettes, model->num_palettes * sizeof(CPalette));
+		for(i = 0; i < model->num_palettes; i++)
+			palettes[i].data = OFS(put(buf, palettes[i].data, palettes[i].size));
+		m.palettes = OFS(put(buf, palettes, model->num_palettes * sizeof(CPalette)));
+		free(palettes);
+	}
+
+	if(model->geometry) {
+		CGeometry* geometry = (CGeometry*) malloc(model->num_dlists * sizeof(CGeometry));
+		memcpy(geometry, model->geometry, model->num_dlists * sizeof(CGeometry));
+		for(i = 0; i < model->num_dlists; i++) {
+			CGeometry* geo = &geometry[i];
+			geo->vertices = OFS(put(buf, geo->vertices, geo->num_vertices * sizeof(CVertex)));
+			/* keep referenced but empty display lists apart from unused ones */
+			if(geo->indices)
+				geo->indices = OFS(put(buf, geo->indices, (geo->num_indices ? geo->num_indices : 1) * sizeof(unsigned int)));
+		}
+		m.geometry = OFS(put(buf, geometry, model->num_dlists * sizeof(CGeometry)));
+		free(geometry);
+	}
+
+	m.nodes = OFS(put(buf, model->nodes, model->num_nodes * sizeof(CNode)));
+	m.meshes = OFS(put(buf, model->meshes, model->num_meshes * sizeof(CMesh)));
+	m.node_pos = OFS(put(buf, model->node_pos, model->num_nodes * sizeof(Vec3)));
+	m.node_initial_pos = OFS(put(buf, model->node_initial_pos, model->num_nodes * sizeof(Vec3)));
+	m.node_weight_ids = OFS(put(buf, model->node_weight_ids, model->num_node_weight * sizeof(int)));
+
+	m.scenedata = NULL;
+	m.baked = NULL;
+	m.baked_size = 0;
+	m.dlists = NULL;
+	m.texture_matrices = NULL;
+	m.animation = NULL;
+	m.node_animation = NULL;
+	m.texcoord_animations = NULL;
+	m.material_animations = NULL;
+
+	memcpy(buf->data + model_ofs, &m, sizeof(CModel));
+}
+
+static CModel* unbake_model(u8* base, u32 size)
+{
+	unsigned int i;
+	CModel* model = (CModel*) malloc(sizeof(CModel));
+	if(!model)
+		fatal_error("bake: Not enough memory!\n");
+
+	memcpy(model, base + sizeof(BakedHeader), sizeof(CModel));
+	model->baked = base;
+	model->baked_size = size;
+
+	model->materials = PTR(base, model->materials);
+	model->textures = PTR(base, model->textures);
+	model->palettes = PTR(base, model->palettes);
+	model->geometry = PTR(base, model->geometry);
+	model->nodes = PTR(base, model->nodes);
+	model->meshes = PTR(base, model->meshes);
+	model->node_pos = PTR(base, model->node_pos);
+	model->node_initial_pos = PTR(base, model->node_initial_pos);
+	model->node_weight_ids = PTR(base, model->node_weight_ids);
+
+	for(i = 0; model->materials && i < model->num_materials; i++)
+		model->materials[i].image = PTR(base, model->materials[i].image);
+	for(i = 0; model->textures && i < model->num_textures; i++)
+		model->textures[i].data = PTR(base, model->textures[i].data);
+	for(i = 0; model->palettes && i < model->num_palettes; i++)
+		model->palettes[i].data = PTR(base, model->palettes[i].data);
+	for(i = 0; model->geometry && i < model->num_dlists; i++) {
+		model->geometry[i].vertices = PTR(base, model->geometry[i].vertices);
+		model->geometry[i].indices = PTR(base, model->geometry[i].indices);
+	}
+
+	model->dlists = NULL;
+	model->vbo = 0;
+	model->ibo = 0;
+
+	return model;
+}
+
+static void init_header(BakedHeader* header, const FileStamp* scene, const FileStamp* textures, int layer_mask)
+{
+	memset(header, 0, sizeof(BakedHeader));
+	memcpy(header->magic, "MPHBAKE", 8);
+	header->version = BAKE_VERSION;
+	header->pointer_size = sizeof(void*);
+	header->model_size = sizeof(CModel);
+	header->material_size = sizeof(CMaterial);
+	header->node_size = sizeof(CNode);
+	header->vertex_size = sizeof(CVertex);
+	header->scene = *scene;
+	header->textures = *textures;
+	header->layer_mask = layer_mask;
+	header->indexed = CModel_indexed_textures();
+}
+
+static CModel* read_baked(const char* path, const BakedHeader* key)
+{
+	FSFile file;
+	BakedHeader* header;
+	u32 len;
+
+	FS_InitFile(&file);
+	if(!FS_OpenHostFile(&file, path))
+		return NULL;
+
+	len = FS_GetLength(&file);
+	/* private writable mapping, materials and nodes are modified at runtime */
+	header = (BakedHeader*) FS_MapFile(&file, FS_MAP_COPY);
+	FS_CloseFile(&file);
+	if(!header)
+		return NULL;
+
+	if(len < sizeof(BakedHeader) + sizeof(CModel) || len != header->size ||
+			memcmp(header, key, offsetof(BakedHeader, size))) {
+		printf("baked model %s is stale\n", path);
+		FS_UnmapFile(header, len);
+		return NULL;
+	}
+
+	return unbake_model((u8*) header, len);
+}
+
+static void write_baked(const char* path, const BakedHeader* key, const CModel* model)
+{
+	char tmp[256];
+	BakeBuffer buf = { NULL, 0, 0 };
+	BakedHeader* header;
+	unsigned int count;
+	FILE* f;
+
+	pthread_mutex_lock(&tmp_lock);
+	count = tmp_count++;
+	pthread_mutex_unlock(&tmp_lock);
+	if(snprintf(tmp, sizeof(tmp), "%s.%d.%u.tmp", path, (int) getpid(), count) >= (int) sizeof(tmp)) {
+		printf("baked model path %s is too long\n", path);
+		return;
+	}
+
+	put(&buf, key, sizeof(BakedHeader));
+	bake_model(&buf, model);
+	header = (BakedHeader*) buf.data;
+	header->size = buf.size;
+
+	f = fopen(tmp, "wb");
+	if(!f) {
+		printf("cannot write baked model %s\n", tmp);
+		free(buf.data);
+		return;
+	}
+
+	if(fwrite(buf.data, 1, buf.size, f) != buf.size) {
+		printf("cannot write baked model %s\n", tmp);
+		fclose(f);
+		remove(tmp);
+		free(buf.data);
+		return;
+	}
+	fclose(f);
+	free(buf.data);
+
+#ifdef _WIN32
+	remove(path);
+#endif
+	if(rename(tmp, path))
+		remove(tmp);
+	else
+		printf("baked %s\n", path);
+}
+
+/* one file per model and layer mask, e.g. models_Door_Model.bin.ffffffff.baked */
+static bool baked_path(char* path, unsigned int size, const char* name, int layer_mask)
+{
+	char* p;
+
+	if(snprintf(path, size, "%s/%s.%08x.baked", bake_dir, name, layer_mask) >= (int) size) {
+		printf("baked model path for %s is too long\n", name);
+		return false;
+	}
+	for(p = path + strlen(bake_dir) + 1; *p; p++) {
+		if(*p == '/' || *p == '\\')
+			*p = '_';
+	}
+	return true;
+}
+
+CModel* CModel_find_baked(const char* name, const FileStamp* scene, const FileStamp* textures, int layer_mask)
+{
+	char path[256];
+	BakedHeader key;
+	CModel* model;
+
+	if(!bake_dir || !baked_path(path, sizeof(path), name, layer_mask))
+		return NULL;
+
+	init_header(&key, scene, textures, layer_mask);
+	model = read_baked(path, &key);
+	if(model)
+		printf("using baked model %s\n", path);
+	return model;
+}
+
+void CModel_store_baked(const char* name, const FileStamp* scene, const FileStamp* textures, int layer_mask, const CModel* model)
+{
+	char path[256];
+	BakedHeader key;
+
+	if(!bake_dir || !baked_path(path, sizeof(path), name, layer_mask))
+		return;
+
+	init_header(&key, scene, textures, layer_mask);
+	write_baked(path, &key, model);
+}
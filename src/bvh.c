@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include "types.h"
+#include "error.h"
+#include "cull.h"
+#include "occlusion.h"
+#include "bvh.h"
+
+/*
+
+	Bounding volume hierarchy
+
+	Built top-down with the surface area heuristic evaluated over BINS
+	buckets of item centroids per axis. Nodes are stored depth first: the
+	left child directly follows its parent, the right child index is kept in
+	the node. Every node knows the item range of its subtree, so a culled
+	subtree can be counted without visiting it.
+
+*/
+
+#define BINS		16
+#define MAX_LEAF_ITEMS	4
+#define TRAVERSAL_COST	1.0f
+#define ITEM_COST	1.0f
+
+typedef struct {
+	BVH*		bvh;
+	unsigned int	max_nodes;
+} BuildState;
+
+static void clear_bounds(float b[3][2])
+{
+	int i;
+	for(i = 0; i < 3; i++) {
+		b[i][0] = FLT_MAX;
+		b[i][1] = -FLT_MAX;
+	}
+}
+
+static void grow_bounds(float b[3][2], const float other[3][2])
+{
+	int i;
+	for(i = 0; i < 3; i++) {
+		if(other[i][0] < b[i][0])
+			b[i][0] = other[i][0];
+		if(other[i][1] > b[i][1])
+			b[i][1] = other[i][1];
+	}
+}
+
+static float half_area(const float b[3][2])
+{
+	float dx = b[0][1] - b[0][0];
+	float dy = b[1][1] - b[1][0];
+	float dz = b[2][1] - b[2][0];
+	if(dx < 0)
+		return 0.0f;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static float centroid(const BVHItem* item, int axis)
+{
+	return (item->bounds[axis][0] + item->bounds[axis][1]) * 0.5f;
+}
+
+static unsigned int new_node(BuildState* st)
+{
+	BVH* bvh = st->bvh;
+	if(bvh->num_nodes == st->max_nodes) {
+		st->max_nodes *= 2;
+		bvh->nodes = (BVHNode*) realloc(bvh->nodes, st->max_nodes * sizeof(BVHNode));
+		if(!bvh->nodes)
+			fatal_error("BVH_build: Not enough memory!\n");
+	}
+	return bvh->num_nodes++;
+}
+
+static void build_node(BuildState* st, unsigned int idx, unsigned int first, unsigned int count)
+{
+	BVH* bvh = st->bvh;
+	BVHItem* items = bvh->items;
+	float bounds[3][2];
+	float cbounds[3][2];
+	float best_cost;
+	int best_axis = -1;
+	int best_split = 0;
+	unsigned int i, mid;
+	int axis;
+
+	clear_bounds(bounds);
+	clear_bounds(cbounds);
+	for(i = first; i < first + count; i++) {
+		grow_bounds(bounds, items[i].bounds);
+		for(axis = 0; axis < 3; axis++) {
+			float c = centroid(&items[i], axis);
+			if(c < cbounds[axis][0])
+				cbounds[axis][0] = c;
+			if(c > cbounds[axis][1])
+				cbounds[axis][1] = c;
+		}
+	}
+
+	memcpy(bvh->nodes[idx].bounds, bounds, sizeof(bounds));
+	bvh->nodes[idx].first = first;
+	bvh->nodes[idx].count = count;
+	bvh->nodes[idx].right = 0;
+
+	if(count <= MAX_LEAF_ITEMS)
+		return;
+
+	/* cost of not splitting, relative to the parent area */
+	best_cost = ITEM_COST * count;
+
+	for(axis = 0; axis < 3; axis++) {
+		float extent = cbounds[axis][1] - cbounds[axis][0];
+		float bin_bounds[BINS][3][2];
+		unsigned int bin_count[BINS];
+		float left_area[BINS];
+		unsigned int left_count[BINS];
+		float acc[3][2];
+		unsigned int n;
+		int b;
+
+		if(extent <= 0.0f)
+			continue;
+
+		for(b = 0; b < BINS; b++) {
+			clear_bounds(bin_bounds[b]);
+			bin_count[b] = 0;
+		}
+		for(i = first; i < first + count; i++) {
+			b = (int) ((centroid(&items[i], axis) - cbounds[axis][0]) / extent * BINS);
+			if(b >= BINS)
+				b = BINS - 1;
+			bin_count[b]++;
+			grow_bounds(bin_bounds[b], items[i].bounds);
+		}
+
+		/* sweep from the left, then evaluate the splits from the right */
+		clear_bounds(acc);
+		n = 0;
+		for(b = 0; b < BINS - 1; b++) {
+			grow_bounds(acc, bin_bounds[b]);
+			n += bin_count[b];
+			left_area[b] = half_area(acc);
+			left_count[b] = n;
+		}
+
+		clear_bounds(acc);
+		n = 0;
+		for(b = BINS - 1; b > 0; b--) {
+			float cost;
+			grow_bounds(acc, bin_bounds[b]);
+			n += bin_count[b];
+			if(!n || !left_count[b - 1])
+				continue;
+			cost = TRAVERSAL_COST + ITEM_COST * (left_area[b - 1] * left_count[b - 1] + half_area(acc) * n) / half_area(bounds);
+			if(cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	if(best_axis < 0) {
+		/* all centroids in one spot or splitting does not pay off, but keep leaves small */
+		if(count <= MAX_LEAF_ITEMS * 4)
+			return;
+		mid = first + count / 2;
+	} else {
+		float extent = cbounds[best_axis][1] - cbounds[best_axis][0];
+		unsigned int j = first + count;
+		i = first;
+		while(i < j) {
+			int b = (int) ((centroid(&items[i], best_axis) - cbounds[best_axis][0]) / extent * BINS);
+			if(b >= BINS)
+				b = BINS - 1;
+			if(b < best_split) {
+				i++;
+			} else {
+				BVHItem tmp = items[i];
+				items[i] = items[--j];
+				items[j] = tmp;
+			}
+		}
+		mid = i;
+	}
+
+	build_node(st, new_node(st), first, mid - first);
+	bvh->nodes[idx].right = new_node(st);
+	build_node(st, bvh->nodes[idx].right, mid, first + count - mid);
+}
+
+BVH* BVH_build(const BVHItem* items, unsigned int count)
+{
+	BuildState st;
+	BVH* bvh = (BVH*) malloc(sizeof(BVH));
+	if(!bvh)
+		fatal_error("BVH_build: Not enough memory!\n");
+
+	bvh->num_items = count;
+	bvh->items = (BVHItem*) malloc(count * sizeof(BVHItem) + 1);
+	st.max_nodes = 16;
+	bvh->nodes = (BVHNode*) malloc(st.max_nodes * sizeof(BVHNode));
+	bvh->num_nodes = 0;
+	st.bvh = bvh;
+	if(!bvh->items || !bvh->nodes)
+		fatal_error("BVH_build: Not enough memory!\n");
+
+	memcpy(bvh->items, items, count * sizeof(BVHItem));
+	build_node(&st, new_node(&st), 0, count);
+
+	return bvh;
+}
+
+void BVH_free(BVH* bvh)
+{
+	free(bvh->nodes);
+	free(bvh->items);
+	free(bvh);
+}
+
+static void cull_node(const BVH* bvh, unsigned int idx, int inside, BVHVisitFunc func, void* arg)
+{
+	const BVHNode* node = &bvh->nodes[idx];
+	unsigned int i;
+
+	if(!inside) {
+		int result = CULLClassifyBounds(node->bounds);
+		if(result == CULL_OUTSIDE) {
+			cull_stats.frustum_culled += node->count;
+			return;
+		}
+		inside = result == CULL_INSIDE;
+	}
+
+	if(!OCCLTestBounds(node->bounds)) {
+		cull_stats.occluded += node->count;
+		return;
+	}
+
+	if(node->right) {
+		cull_node(bvh, idx + 1, inside, func, arg);
+		cull_node(bvh, node->right, inside, func, arg);
+		return;
+	}
+
+	for(i = node->first; i < node->first + node->count; i++) {
+		const BVHItem* item = &bvh->items[i];
+		if(!inside && !CULLTestBounds(item->bounds)) {
+			cull_stats.frustum_culled++;
+			continue;
+		}
+		if(!OCCLTestBounds(item->bounds)) {
+			cull_stats.occluded++;
+			continue;
+		}
+		func(item, arg);
+	}
+}
+
+void BVH_cull(const BVH* bvh, BVHVisitFunc func, void* arg)
+{
+	if(bvh->num_items)
+		cull_node(bvh, 0, 0, func, arg);
+}
+
+/* slab test, returns the entry distance or FLT_MAX on a miss */
+static float ray_box(const float b[3][2], const float origin[3], const float inv_dir[3], float max_t)
+{
+	float tmin = 0.0f;
+	float tmax = max_t;
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		float t0 = (b[i][0] - origin[i]) * inv_dir[i];
+		float t1 = (b[i][1] - origin[i]) * inv_dir[i];
+		if(t0 > t1) {
+			float tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		if(t0 > tmin)
+			tmin = t0;
+		if(t1 < tmax)
+			tmax = t1;
+		if(tmin > tmax)
+			return FLT_MAX;
+	}
+	return tmin;
+}
+
+int BVH_raycast(const BVH* bvh, const float origin[3], const float dir[3], float* t)
+{
+	unsigned int stack[64];
+	unsigned int sp = 0;
+	float inv_dir[3];
+	float best_t = FLT_MAX;
+	int best = -1;
+	unsigned int i;
+
+	if(!bvh->num_items)
+		return -1;
+
+	for(i = 0; i < 3; i++)
+		inv_dir[i] = dir[i] != 0.0f ? 1.0f / dir[i] : FLT_MAX;
+
+	stack[sp++] = 0;
+	while(sp) {
+		const BVHNode* node = &bvh->nodes[stack[--sp]];
+		if(ray_box(node->bounds, origin, inv_dir, best_t) == FLT_MAX)
+			continue;
+
+		if(node->right) {
+			if(sp + 2 > sizeof(stack) / sizeof(stack[0]))
+				fatal_error("BVH_raycast: Stack overflow!\n");
+			stack[sp++] = node->right;
+			stack[sp++] = (unsigned int) (node - bvh->nodes) + 1;
+			continue;
+		}
+
+		for(i = node->first; i < node->first + node->count; i++) {
+			float d = ray_box(bvh->items[i].bounds, origin, inv_dir, best_t);
+			if(d < best_t) {
+				best_t = d;
+				best = i;
+			}
+		}
+	}
+
+	if(t)
+		*t = best_t;
+	return best;
+}
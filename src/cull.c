@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "types.h"
+#include "mtx.h"
+#include "cull.h"
+
+CullStats cull_stats;
+
+static Mtx44 clip;
+static float planes[6][4];
+
+/* Gribb/Hartmann: the planes are sums and differences of the rows of the clip matrix */
+void CULLBeginFrame(const Mtx44* projection, const Mtx44* view)
+{
+	int i, j;
+
+	MTX44Concat(projection, view, &clip);
+
+	for(i = 0; i < 3; i++) {
+		for(j = 0; j < 4; j++) {
+			/* m[col][row] */
+			planes[i * 2][j] = clip.m[j][3] + clip.m[j][i];
+			planes[i * 2 + 1][j] = clip.m[j][3] - clip.m[j][i];
+		}
+	}
+
+	memset(&cull_stats, 0, sizeof(cull_stats));
+}
+
+int CULLClassifyBounds(const float bounds[3][2])
+{
+	int i;
+	int result = CULL_INSIDE;
+
+	if(!frustum_culling)
+		return CULL_INSIDE;
+
+	/* empty box */
+	if(bounds[0][0] > bounds[0][1])
+		return CULL_OUTSIDE;
+
+	for(i = 0; i < 6; i++) {
+		const float* p = planes[i];
+		/* the corners furthest along and against the plane normal */
+		float x = p[0] > 0 ? bounds[0][1] : bounds[0][0];
+		float y = p[1] > 0 ? bounds[1][1] : bounds[1][0];
+		float z = p[2] > 0 ? bounds[2][1] : bounds[2][0];
+		if(p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+			return CULL_OUTSIDE;
+		x = p[0] > 0 ? bounds[0][0] : bounds[0][1];
+		y = p[1] > 0 ? bounds[1][0] : bounds[1][1];
+		z = p[2] > 0 ? bounds[2][0] : bounds[2][1];
+		if(p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+			result = CULL_INTERSECT;
+	}
+	return result;
+}
+
+bool CULLTestBounds(const float bounds[3][2])
+{
+	return CULLClassifyBounds(bounds) != CULL_OUTSIDE;
+}
+
+/* screen rectangle (NDC x0, y0, x1, y1) covered by a world space box, the
+   whole screen if the box reaches behind the eye */
+void CULLProjectBounds(const float bounds[3][2], float rect[4])
+{
+	int i;
+
+	rect[0] = rect[1] = 1.0f;
+	rect[2] = rect[3] = -1.0f;
+
+	for(i = 0; i < 8; i++) {
+		float x = bounds[0][i & 1];
+		float y = bounds[1][(i >> 1) & 1];
+		float z = bounds[2][(i >> 2) & 1];
+		float cx = clip.m[0][0] * x + clip.m[1][0] * y + clip.m[2][0] * z + clip.m[3][0];
+		float cy = clip.m[0][1] * x + clip.m[1][1] * y + clip.m[2][1] * z + clip.m[3][1];
+		float cw = clip.m[0][3] * x + clip.m[1][3] * y + clip.m[2][3] * z + clip.m[3][3];
+
+		if(cw < 1e-4f) {
+			rect[0] = rect[1] = -1.0f;
+			rect[2] = rect[3] = 1.0f;
+			return;
+		}
+
+		cx /= cw;
+		cy /= cw;
+		if(cx < rect[0]) rect[0] = cx;
+		if(cx > rect[2]) rect[2] = cx;
+		if(cy < rect[1]) rect[1] = cy;
+		if(cy > rect[3]) rect[3] = cy;
+	}
+
+	for(i = 0; i < 2; i++) {
+		if(rect[i] < -1.0f) rect[i] = -1.0f;
+		if(rect[i + 2] > 1.0f) rect[i + 2] = 1.0f;
+	}
+}
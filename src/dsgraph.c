@@ -14,6 +14,11 @@
 #include "room.h"
 #include "entity.h"
 #include "game.h"
+#include "archive.h"
+#include "loader.h"
+#include "bake.h"
+#include "cull.h"
+#include "glstate.h"
 
 #define M_PI		3.14159265358979323846
 
@@ -26,6 +31,10 @@ bool culling = true;
 bool tex_filtering = true;
 bool animate = true;
 bool lighting = true;
+bool frustum_culling = true;
+bool occlusion_culling = true;
+bool weighted_oit = false;
+int max_occluders = 16;
 
 float sin_deg(float deg) {
 	return sin(deg * M_PI / 180);
@@ -266,6 +275,34 @@ void kb_func(unsigned char key, int x, int y)
 		}
 		break;
 
+		case 'v':	case 'V': {
+			frustum_culling = !frustum_culling;
+			printf("frustum culling %s\n", frustum_culling ? "on" : "off");
+			glutPostRedisplay();
+		}
+		break;
+
+		case 'z':	case 'Z': {
+			occlusion_culling = !occlusion_culling;
+			printf("occlusion culling %s\n", occlusion_culling ? "on" : "off");
+			glutPostRedisplay();
+		}
+		break;
+
+		case 'o':	case 'O': {
+			weighted_oit = !weighted_oit;
+			printf("translucency %s\n", weighted_oit ? "weighted blended" : "sorted by stencil");
+			glutPostRedisplay();
+		}
+		break;
+
+		case 'i':	case 'I': {
+			printf("meshes: %u submitted, %u frustum culled, %u portal culled, %u occluded\n", cull_stats.submitted, cull_stats.frustum_culled, cull_stats.portal_culled, cull_stats.occluded);
+			printf("gl state: %u calls, %u skipped as redundant\n", gl_state_stats.calls, gl_state_stats.skipped);
+			printf("frame arena: %u bytes used, %u high water\n", frame_arena.used, frame_arena.high_water);
+		}
+		break;
+
 		case ' ':
 			key_down_speed = true;
 			break;
@@ -305,6 +342,7 @@ void process()
 
 void display_func(void)
 {
+	process_async_loads();
 	process();
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -392,14 +430,23 @@ int main(int argc, char **argv)
 	unsigned int layer_mask = 0;
 	argc--;
 	argv++;
-	if(argc > 1 && !strcmp(argv[0], "-f")) {
-		modestring = argv[1];
+	while(argc > 1 && argv[0][0] == '-') {
+		if(!strcmp(argv[0], "-f"))
+			modestring = argv[1];
+		else if(!strcmp(argv[0], "-c"))
+			SetArchiveCacheDir(argv[1]);
+		else if(!strcmp(argv[0], "-b"))
+			SetModelBakeDir(argv[1]);
+		else if(!strcmp(argv[0], "-o"))
+			max_occluders = atoi(argv[1]);
+		else
+			break;
 		argc -= 2;
 		argv += 2;
 	}
 	if(argc != 1 && argc != 2) {
 		printf("Metroid Prime Hunters model viewer\n");
-		printf("Usage: dsgraph <id> [layer-mask]\n");
+		printf("Usage: dsgraph [-f modestring] [-c cachedir] [-b bakedir] [-o occluders] <id> [layer-mask]\n");
 		exit(0);
 	}
 
@@ -425,6 +472,8 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	GAMEPreloadRoom(room_id);
+
 	if(!use_game_mode) {
 		glutInitWindowSize(512, 512);
 		glutInitWindowPosition(100, 100);
@@ -484,6 +533,10 @@ int main(int argc, char **argv)
 	printf(" - F toggles texture filtering\n");
 	printf(" - G toggles fog\n");
 	printf(" - L toggles lighting\n");
+	printf(" - V toggles frustum culling\n");
+	printf(" - Z toggles occlusion culling\n");
+	printf(" - O toggles weighted blended translucency\n");
+	printf(" - I prints the number of submitted and culled meshes\n");
 
 	glutMainLoop();
 
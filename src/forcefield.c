@@ -10,6 +10,7 @@
 #include "vec.h"
 #include "os.h"
 #include "heap.h"
+#include "loader.h"
 
 static const u16 force_field_scan_ids[10] = { 0, 0x126, 0x127, 0x123, 0x122, 0x124, 0x125, 0x128, 0, 0x10B };
 
@@ -21,6 +22,40 @@ static CAnimation* force_field_lock_anim = NULL;
 extern const char door_palette_ids[10];
 extern CModel* alimbic_palettes_model;
 
+/* every force field gets its own copy of the model with the palette of its type */
+static void force_field_instance_ready(CModel* model, void* arg)
+{
+	CForceField* obj = (CForceField*) arg;
+	CModel* copy = (CModel*) alloc_from_heap(sizeof(CModel));
+
+	memcpy(copy, model, sizeof(CModel));
+	copy->materials = (CMaterial*) alloc_from_heap(sizeof(CMaterial) * copy->num_materials);
+	memcpy(copy->materials, model->materials, sizeof(CMaterial) * copy->num_materials);
+	copy->palettes = (CPalette*) alloc_from_heap(sizeof(CPalette) * copy->num_palettes);
+	memcpy(copy->palettes, model->palettes, sizeof(CPalette) * copy->num_palettes);
+
+	int palid = door_palette_ids[obj->type];
+	memcpy(copy->palettes, &alimbic_palettes_model->palettes[palid], sizeof(CPalette));
+
+	CModel_set_textures(copy);
+	obj->model = copy;
+}
+
+static void force_field_ready(CModel* model, void* arg)
+{
+	if(!force_field_anim)
+		load_animation(&force_field_anim, "models/ForceField_Anim.bin", model, 0);
+}
+
+static void force_field_lock_ready(CModel* model, void* arg)
+{
+	if(model->textures || model->palettes)
+		OS_Terminate();
+	load_texture_container(model, 0);
+	if(!force_field_lock_anim)
+		load_animation(&force_field_lock_anim, "models/ForceFieldLock_mdl_Anim.bin", model, 0);
+}
+
 CEntity* CForceField_construct(const char* node_name, EntityData* data)
 {
 	if(data->type != FORCE_FIELD)
@@ -67,17 +102,8 @@ CEntity* CForceField_construct(const char* node_name, EntityData* data)
 	VEC_CrossProduct(&force_field->vec1, &force_field->vec2, &normal);
 	VEC_Normalize(&normal, &normal);
 
-	obj->model = (CModel*) alloc_from_heap(sizeof(CModel));
-	memcpy(obj->model, force_field_model, sizeof(CModel));
-	obj->model->materials = (CMaterial*) alloc_from_heap(sizeof(CMaterial) * obj->model->num_materials);
-	memcpy(obj->model->materials, force_field_model->materials, sizeof(CMaterial) * obj->model->num_materials);
-	obj->model->palettes = (CPalette*) alloc_from_heap(sizeof(CPalette) * obj->model->num_palettes);
-	memcpy(obj->model->palettes, force_field_model->palettes, sizeof(CPalette) * obj->model->num_palettes);
-
-	int palid = door_palette_ids[obj->type];
-	memcpy(obj->model->palettes, &alimbic_palettes_model->palettes[palid], sizeof(CPalette));
-
-	CModel_set_textures(obj->model);
+	obj->model = NULL;
+	load_model_async(&force_field_model, "models/ForceField_Model.bin", 0, force_field_instance_ready, obj);
 
 	// TODO: if(obj->flags & 1 && force_field->type != 9) spawn(ENEMY_INSTANCE, 49);
 
@@ -86,7 +112,8 @@ CEntity* CForceField_construct(const char* node_name, EntityData* data)
 
 void CForceField_process_class(float dt)
 {
-	CAnimation_process(force_field_anim, dt);
+	if(force_field_anim)
+		CAnimation_process(force_field_anim, dt);
 }
 
 void CForceField_process(CEntity* obj, float dt)
@@ -135,7 +162,8 @@ Vec3* CForceField_get_position(CEntity* obj)
 
 void CForceField_set_tex_filter(int type)
 {
-	CModel_set_texture_filter(force_field_model, type);
+	if(force_field_model)
+		CModel_set_texture_filter(force_field_model, type);
 }
 
 void EntForceFieldRegister(void)
@@ -149,13 +177,8 @@ void EntForceFieldRegister(void)
 	ent->set_tex_filter = CForceField_set_tex_filter;
 
 	if(!force_field_model) {
-		load_model(&force_field_model, "models/ForceField_Model.bin", 0);
-		load_animation(&force_field_anim, "models/ForceField_Anim.bin", force_field_model, 0);
-		load_model(&force_field_lock_model, "models/ForceFieldLock_mdl_Model.bin", 0);
-		load_animation(&force_field_lock_anim, "models/ForceFieldLock_mdl_Anim.bin", force_field_lock_model, 0);
-		if(force_field_lock_model->textures || force_field_lock_model->palettes)
-			OS_Terminate();
-		load_texture_container(force_field_lock_model, 0);
+		load_model_async(&force_field_model, "models/ForceField_Model.bin", 0, force_field_ready, NULL);
+		load_model_async(&force_field_lock_model, "models/ForceFieldLock_mdl_Model.bin", 0, force_field_lock_ready, NULL);
 	}
 
 	if(!alimbic_palettes_model)
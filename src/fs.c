@@ -1,4 +1,13 @@
 #include <stdlib.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+/* from the CRT's <io.h>, which is shadowed by include/io.h */
+_CRTIMP intptr_t __cdecl _get_osfhandle(int fd);
+#else
+#include <sys/mman.h>
+#endif
 
 #include "fs.h"
 
@@ -16,9 +25,15 @@ void FS_InitFile(FSFile* p_file)
 BOOL FS_OpenFile(FSFile* p_file, const char* path)
 {
 	char buf[256];
-	size_t size;
 	sprintf(buf, "data/%s", path);
-	p_file->stdio_file = fopen(buf, "rb");
+	return FS_OpenHostFile(p_file, buf);
+}
+
+/* PC version: open a path on the host file system as-is */
+BOOL FS_OpenHostFile(FSFile* p_file, const char* path)
+{
+	size_t size;
+	p_file->stdio_file = fopen(path, "rb");
 	if(!p_file->stdio_file)
 		return FALSE;
 	fseek(p_file->stdio_file, 0, SEEK_END);
@@ -74,6 +89,53 @@ BOOL FS_SeekFile(FSFile *p_file, s32 offset, FSSeekFileMode origin)
 	return TRUE;
 }
 
+/* PC version: modification time of the host file, 0 if unknown */
+u64 FS_GetModifiedTime(FSFile* p_file)
+{
+	struct stat st;
+	if(!p_file->stdio_file || fstat(fileno(p_file->stdio_file), &st))
+		return 0;
+	return (u64) st.st_mtime;
+}
+
+/* PC version: map the whole file into memory. The mapping stays valid after
+ * FS_CloseFile and has to be released with FS_UnmapFile. */
+void* FS_MapFile(FSFile* p_file, FSMapMode mode)
+{
+	u32 len = FS_GetLength(p_file);
+	void* ptr;
+
+	if(!p_file->stdio_file || !len)
+		return NULL;
+
+#ifdef _WIN32
+	HANDLE file = (HANDLE) _get_osfhandle(_fileno(p_file->stdio_file));
+	HANDLE mapping = CreateFileMapping(file, NULL, mode == FS_MAP_COPY ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if(!mapping)
+		return NULL;
+	ptr = MapViewOfFile(mapping, mode == FS_MAP_COPY ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, len);
+	CloseHandle(mapping);
+	return ptr;
+#else
+	int prot = mode == FS_MAP_COPY ? PROT_READ | PROT_WRITE : PROT_READ;
+	ptr = mmap(NULL, len, prot, MAP_PRIVATE, fileno(p_file->stdio_file), 0);
+	if(ptr == MAP_FAILED)
+		return NULL;
+	return ptr;
+#endif
+}
+
+void FS_UnmapFile(void* ptr, u32 len)
+{
+	if(!ptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(ptr);
+#else
+	munmap(ptr, len);
+#endif
+}
+
 /* PC version */
 BOOL FSi_SendCommand(FSFile *p_file, FSCommandType command)
 {
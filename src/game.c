@@ -12,6 +12,8 @@
 #include "hud.h"
 #include "world.h"
 #include "heap.h"
+#include "worker.h"
+#include "loader.h"
 
 #ifdef _WIN32
 extern PFNGLLOADTRANSPOSEMATRIXFPROC	glLoadTransposeMatrixf;
@@ -33,6 +35,13 @@ extern float yrot;
 
 extern bool show_entities;
 
+/* start decoding the archives a room needs before the GL context exists */
+void GAMEPreloadRoom(int room_id)
+{
+	LoadArchiveAsync("common", "archives/common.arc");
+	LoadArchiveAsync(rooms[room_id].archive_name, rooms[room_id].archive);
+}
+
 void GAMEInit()
 {
 	game_state.game_mode = SINGLE_PLAYER;
@@ -55,11 +64,14 @@ void GAMESetRoom(int room_id, unsigned int layer_mask)
 
 void GAMEUnloadRoom(void)
 {
+	/* callbacks of pending loads still reference the room's entities */
+	finish_async_loads();
 	if(room) {
 		CRoom_free(room);
 		free_to_heap(room);
 	}
 	room = NULL;
+	WorkerShutdown();
 }
 
 void GAMERenderScene(float aspect)
@@ -0,0 +1,334 @@
+#ifdef _WIN32
+#undef WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/gl.h>
+#include <GL/glext.h> // for mingw
+
+#include "types.h"
+#include "error.h"
+#include "glstate.h"
+
+/*
+
+	GL state cache
+
+	A shadow copy of the state the model renderer sets per draw. Calls
+	that would set what is already there return without reaching GL.
+	The fixed function state is only trusted from GLSBeginFrame to the end
+	of that frame's draws, as the rest of the viewer still talks to GL
+	directly. Uniform values belong to the program object and are kept
+	until another program is used.
+
+*/
+
+#ifdef _WIN32
+extern PFNGLUSEPROGRAMPROC		glUseProgram;
+extern PFNGLUNIFORM1IPROC		glUniform1i;
+extern PFNGLUNIFORM1FPROC		glUniform1f;
+extern PFNGLUNIFORM2FPROC		glUniform2f;
+extern PFNGLUNIFORM3FVPROC		glUniform3fv;
+extern PFNGLUNIFORM4FVPROC		glUniform4fv;
+extern PFNGLUNIFORMMATRIX4FVPROC	glUniformMatrix4fv;
+extern PFNGLBINDBUFFERPROC		glBindBuffer;
+extern PFNGLACTIVETEXTUREPROC		glActiveTexture;
+extern PFNGLBLENDFUNCSEPARATEPROC	glBlendFuncSeparate;
+#endif
+
+#define MAX_TEXTURE_UNITS	4
+#define MAX_UNIFORMS		256
+
+enum {
+	ST_PROGRAM,
+	ST_ACTIVE_TEXTURE,
+	ST_TEXTURE,
+	ST_ARRAY_BUFFER = ST_TEXTURE + MAX_TEXTURE_UNITS,
+	ST_ELEMENT_ARRAY_BUFFER,
+	ST_CULL_FACE,
+	ST_BLEND,
+	ST_DEPTH_TEST,
+	ST_STENCIL_TEST,
+	ST_ALPHA_TEST,
+	ST_LIGHTING,
+	ST_POLYGON_OFFSET_FILL,
+	ST_CULL_FACE_MODE,
+	ST_DEPTH_FUNC,
+	ST_DEPTH_MASK,
+	ST_COLOR_MASK,
+	ST_STENCIL_FUNC,
+	ST_STENCIL_OP,
+	ST_STENCIL_MASK,
+	ST_ALPHA_FUNC,
+	ST_BLEND_FUNC,
+	ST_POLYGON_OFFSET,
+	ST_AMBIENT,
+	ST_DIFFUSE,
+	NUM_STATES
+};
+
+typedef struct {
+	bool		valid;
+	u32		v[4];
+} State;
+
+typedef struct {
+	unsigned int	size;
+	unsigned int	capacity;
+	void*		data;
+} Uniform;
+
+GLStateStats gl_state_stats;
+
+static State states[NUM_STATES];
+static Uniform uniforms[MAX_UNIFORMS];
+static GLuint uniform_program;
+
+static u32 float_bits(float f)
+{
+	union {
+		float	f;
+		u32	u;
+	} x;
+	x.f = f;
+	return x.u;
+}
+
+/* records the new value, FALSE if it was set already */
+static bool set_state(int id, u32 a, u32 b, u32 c, u32 d)
+{
+	State* s = &states[id];
+
+	gl_state_stats.calls++;
+	if(s->valid && s->v[0] == a && s->v[1] == b && s->v[2] == c && s->v[3] == d) {
+		gl_state_stats.skipped++;
+		return false;
+	}
+	s->valid = true;
+	s->v[0] = a;
+	s->v[1] = b;
+	s->v[2] = c;
+	s->v[3] = d;
+	return true;
+}
+
+static bool set_uniform(GLint location, const void* data, unsigned int size)
+{
+	Uniform* u;
+
+	gl_state_stats.calls++;
+	if(location < 0 || location >= MAX_UNIFORMS)
+		return true;
+
+	/* the program in use is known, uniforms are only set between draws */
+	if(states[ST_PROGRAM].v[0] != uniform_program) {
+		unsigned int i;
+		for(i = 0; i < MAX_UNIFORMS; i++)
+			uniforms[i].size = 0;
+		uniform_program = states[ST_PROGRAM].v[0];
+	}
+
+	u = &uniforms[location];
+	if(u->size == size && !memcmp(u->data, data, size)) {
+		gl_state_stats.skipped++;
+		return false;
+	}
+	if(u->capacity < size) {
+		u->data = realloc(u->data, size);
+		if(!u->data)
+			fatal_error("GLSUniform: Not enough memory!\n");
+		u->capacity = size;
+	}
+	memcpy(u->data, data, size);
+	u->size = size;
+	return true;
+}
+
+void GLSBeginFrame(void)
+{
+	unsigned int i;
+	for(i = 0; i < NUM_STATES; i++)
+		states[i].valid = false;
+	gl_state_stats.calls = 0;
+	gl_state_stats.skipped = 0;
+}
+
+void GLSEndFrame(void)
+{
+	if(!states[ST_ACTIVE_TEXTURE].valid || states[ST_ACTIVE_TEXTURE].v[0] != 0) {
+		glActiveTexture(GL_TEXTURE0);
+		states[ST_ACTIVE_TEXTURE].valid = true;
+		states[ST_ACTIVE_TEXTURE].v[0] = 0;
+	}
+}
+
+void GLSUseProgram(GLuint program)
+{
+	if(set_state(ST_PROGRAM, program, 0, 0, 0))
+		glUseProgram(program);
+}
+
+void GLSBindTexture(unsigned int unit, GLuint tex)
+{
+	if(unit >= MAX_TEXTURE_UNITS)
+		fatal_error("GLSBindTexture: unit %u out of range\n", unit);
+
+	if(!set_state(ST_TEXTURE + unit, tex, 0, 0, 0))
+		return;
+	/* not a call anyone asked for, kept out of the stats */
+	if(!states[ST_ACTIVE_TEXTURE].valid || states[ST_ACTIVE_TEXTURE].v[0] != unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		states[ST_ACTIVE_TEXTURE].valid = true;
+		states[ST_ACTIVE_TEXTURE].v[0] = unit;
+	}
+	glBindTexture(GL_TEXTURE_2D, tex);
+}
+
+bool GLSBindBuffer(GLenum target, GLuint buffer)
+{
+	int id = target == GL_ARRAY_BUFFER ? ST_ARRAY_BUFFER : ST_ELEMENT_ARRAY_BUFFER;
+	if(!set_state(id, buffer, 0, 0, 0))
+		return false;
+	glBindBuffer(target, buffer);
+	return true;
+}
+
+void GLSEnable(GLenum cap, bool enable)
+{
+	int id;
+
+	switch(cap) {
+		case GL_CULL_FACE:		id = ST_CULL_FACE;		break;
+		case GL_BLEND:			id = ST_BLEND;			break;
+		case GL_DEPTH_TEST:		id = ST_DEPTH_TEST;		break;
+		case GL_STENCIL_TEST:		id = ST_STENCIL_TEST;		break;
+		case GL_ALPHA_TEST:		id = ST_ALPHA_TEST;		break;
+		case GL_LIGHTING:		id = ST_LIGHTING;		break;
+		case GL_POLYGON_OFFSET_FILL:	id = ST_POLYGON_OFFSET_FILL;	break;
+		default:			id = -1;
+	}
+
+	if(id >= 0 && !set_state(id, enable, 0, 0, 0))
+		return;
+	if(enable)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+void GLSCullFace(GLenum mode)
+{
+	if(set_state(ST_CULL_FACE_MODE, mode, 0, 0, 0))
+		glCullFace(mode);
+}
+
+void GLSDepthFunc(GLenum func)
+{
+	if(set_state(ST_DEPTH_FUNC, func, 0, 0, 0))
+		glDepthFunc(func);
+}
+
+void GLSDepthMask(GLboolean flag)
+{
+	if(set_state(ST_DEPTH_MASK, flag, 0, 0, 0))
+		glDepthMask(flag);
+}
+
+void GLSColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+	if(set_state(ST_COLOR_MASK, r, g, b, a))
+		glColorMask(r, g, b, a);
+}
+
+void GLSStencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+	if(set_state(ST_STENCIL_FUNC, func, ref, mask, 0))
+		glStencilFunc(func, ref, mask);
+}
+
+void GLSStencilOp(GLenum fail, GLenum zfail, GLenum zpass)
+{
+	if(set_state(ST_STENCIL_OP, fail, zfail, zpass, 0))
+		glStencilOp(fail, zfail, zpass);
+}
+
+void GLSStencilMask(GLuint mask)
+{
+	if(set_state(ST_STENCIL_MASK, mask, 0, 0, 0))
+		glStencilMask(mask);
+}
+
+void GLSAlphaFunc(GLenum func, GLclampf ref)
+{
+	if(set_state(ST_ALPHA_FUNC, func, float_bits(ref), 0, 0))
+		glAlphaFunc(func, ref);
+}
+
+void GLSBlendFunc(GLenum sfactor, GLenum dfactor)
+{
+	if(set_state(ST_BLEND_FUNC, sfactor, dfactor, sfactor, dfactor))
+		glBlendFunc(sfactor, dfactor);
+}
+
+void GLSBlendFuncSeparate(GLenum srgb, GLenum drgb, GLenum salpha, GLenum dalpha)
+{
+	if(set_state(ST_BLEND_FUNC, srgb, drgb, salpha, dalpha))
+		glBlendFuncSeparate(srgb, drgb, salpha, dalpha);
+}
+
+void GLSPolygonOffset(GLfloat factor, GLfloat units)
+{
+	if(set_state(ST_POLYGON_OFFSET, float_bits(factor), float_bits(units), 0, 0))
+		glPolygonOffset(factor, units);
+}
+
+void GLSMaterialfv(GLenum pname, const GLfloat* params)
+{
+	int id = pname == GL_AMBIENT ? ST_AMBIENT : ST_DIFFUSE;
+	if(pname != GL_AMBIENT && pname != GL_DIFFUSE) {
+		glMaterialfv(GL_FRONT, pname, params);
+		return;
+	}
+	if(set_state(id, float_bits(params[0]), float_bits(params[1]), float_bits(params[2]), float_bits(params[3])))
+		glMaterialfv(GL_FRONT, pname, params);
+}
+
+void GLSUniform1i(GLint location, GLint v)
+{
+	if(set_uniform(location, &v, sizeof(v)))
+		glUniform1i(location, v);
+}
+
+void GLSUniform1f(GLint location, GLfloat v)
+{
+	if(set_uniform(location, &v, sizeof(v)))
+		glUniform1f(location, v);
+}
+
+void GLSUniform2f(GLint location, GLfloat x, GLfloat y)
+{
+	GLfloat v[2] = { x, y };
+	if(set_uniform(location, v, sizeof(v)))
+		glUniform2f(location, x, y);
+}
+
+void GLSUniform3fv(GLint location, GLsizei count, const GLfloat* v)
+{
+	if(set_uniform(location, v, count * 3 * sizeof(GLfloat)))
+		glUniform3fv(location, count, v);
+}
+
+void GLSUniform4fv(GLint location, GLsizei count, const GLfloat* v)
+{
+	if(set_uniform(location, v, count * 4 * sizeof(GLfloat)))
+		glUniform4fv(location, count, v);
+}
+
+void GLSUniformMatrix4fv(GLint location, GLsizei count, const GLfloat* v)
+{
+	if(set_uniform(location, v, count * 16 * sizeof(GLfloat)))
+		glUniformMatrix4fv(location, count, GL_FALSE, v);
+}
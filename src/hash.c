@@ -0,0 +1,169 @@
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_CLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "types.h"
+#include "hash.h"
+
+/*
+
+	Hashing
+
+	fnv1a64 is the quick hash for cache keys and lookup tables. crc32 is
+	the zlib CRC-32 the material overrides are keyed by: eight bytes per
+	step through eight tables (slice-by-8), or folded 64 bytes at a time
+	with carry-less multiplies on CPUs with PCLMULQDQ, after the Intel
+	paper "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ".
+	The path is picked once, on first use.
+
+*/
+
+u64 fnv1a64(const void* data, u32 len)
+{
+	const u8* p = (const u8*) data;
+	u64 hash = 14695981039346656037ULL;
+	while(len--)
+		hash = (hash ^ *(p++)) * 1099511628211ULL;
+	return hash;
+}
+
+#define CRC32_POLY	0xEDB88320
+
+static u32 crc_table[8][256];
+static bool have_clmul = false;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
+{
+	u32 i, j;
+
+	for(i = 0; i < 256; i++) {
+		u32 crc = i;
+		for(j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+		crc_table[0][i] = crc;
+	}
+	for(i = 0; i < 256; i++) {
+		for(j = 1; j < 8; j++)
+			crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^ crc_table[0][crc_table[j - 1][i] & 0xFF];
+	}
+
+#ifdef HAVE_CLMUL
+	unsigned int eax, ebx, ecx, edx;
+	if(__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		have_clmul = (ecx & bit_PCLMUL) && (edx & bit_SSE2);
+#endif
+}
+
+/* on the inverted crc, as are the folding steps */
+static u32 slice8(u32 crc, const u8* p, u32 len)
+{
+	for(; len && ((uintptr_t) p & 7); len--)
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *(p++)) & 0xFF];
+
+	for(; len >= 8; len -= 8, p += 8) {
+		u32 lo = crc ^ ((u32) p[0] | ((u32) p[1] << 8) | ((u32) p[2] << 16) | ((u32) p[3] << 24));
+		u32 hi = (u32) p[4] | ((u32) p[5] << 8) | ((u32) p[6] << 16) | ((u32) p[7] << 24);
+		crc =	crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+			crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+			crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+			crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+	}
+
+	while(len--)
+		crc = (crc >> 8) ^ crc_table[0][(crc ^ *(p++)) & 0xFF];
+	return crc;
+}
+
+#ifdef HAVE_CLMUL
+/* len is at least 64 and a multiple of 16 */
+__attribute__((target("pclmul,sse2")))
+static u32 fold(u32 crc, const u8* p, u32 len)
+{
+	/* x^(512+64) and x^512 mod P, x^(128+64) and x^128, x^64, P and mu, bit reflected */
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x0, x1, x2, x3, x4;
+
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) p), _mm_cvtsi32_si128(crc));
+	x2 = _mm_loadu_si128((const __m128i*) (p + 16));
+	x3 = _mm_loadu_si128((const __m128i*) (p + 32));
+	x4 = _mm_loadu_si128((const __m128i*) (p + 48));
+	p += 64;
+	len -= 64;
+
+	/* four lanes of 128 bits */
+	for(; len >= 64; len -= 64, p += 64) {
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11)), _mm_loadu_si128((const __m128i*) p));
+		x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11)), _mm_loadu_si128((const __m128i*) (p + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11)), _mm_loadu_si128((const __m128i*) (p + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x00), _mm_clmulepi64_si128(x4, k1k2, 0x11)), _mm_loadu_si128((const __m128i*) (p + 48)));
+	}
+
+	/* into one, then the rest 16 bytes at a time */
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x2);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x3);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x4);
+	for(; len >= 16; len -= 16, p += 16)
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), _mm_loadu_si128((const __m128i*) p));
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, low32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x0);
+	return (u32) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+u32 crc32_table(u32 crc, const void* data, u32 len)
+{
+	pthread_once(&crc_once, crc32_init);
+	return ~slice8(~crc, (const u8*) data, len);
+}
+
+bool crc32_clmul_supported(void)
+{
+	pthread_once(&crc_once, crc32_init);
+	return have_clmul;
+}
+
+u32 crc32_clmul(u32 crc, const void* data, u32 len)
+{
+	const u8* p = (const u8*) data;
+
+	pthread_once(&crc_once, crc32_init);
+	crc = ~crc;
+#ifdef HAVE_CLMUL
+	if(have_clmul && len >= 64) {
+		u32 n = len & ~15;
+		crc = fold(crc, p, n);
+		p += n;
+		len -= n;
+	}
+#endif
+	return ~slice8(crc, p, len);
+}
+
+u32 crc32_update(u32 crc, const void* data, u32 len)
+{
+	return crc32_clmul(crc, data, len);
+}
+
+u32 crc32(const void* data, u32 len)
+{
+	return crc32_clmul(0, data, len);
+}
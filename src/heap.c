@@ -1,7 +1,20 @@
 #include <stdlib.h>
 
+#include "error.h"
 #include "heap.h"
 
+#define ARENA_ALIGN		16
+#define ARENA_MIN_BLOCK		(64 * 1024)
+
+struct ArenaBlock {
+	ArenaBlock*	next;
+	unsigned int	size;
+	unsigned int	used;
+};
+
+/* the data follows the header, aligned */
+#define BLOCK_HEADER		((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
 void* alloc_from_heap(unsigned int size)
 {
 	return malloc(size);
@@ -15,3 +28,59 @@ void free_to_heap(void* ptr)
 void check_heap()
 {
 }
+
+static ArenaBlock* new_block(unsigned int size)
+{
+	ArenaBlock* block = (ArenaBlock*) malloc(BLOCK_HEADER + size);
+	if(!block)
+		fatal_error("alloc_from_arena: Not enough memory!\n");
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+void* alloc_from_arena(Arena* arena, unsigned int size)
+{
+	ArenaBlock* block = arena->blocks;
+	void* ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if(!block || block->size - block->used < size) {
+		/* the old blocks stay until the reset */
+		unsigned int block_size = block ? block->size * 2 : ARENA_MIN_BLOCK;
+		while(block_size < size)
+			block_size *= 2;
+		block = new_block(block_size);
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = (char*) block + BLOCK_HEADER + block->used;
+	block->used += size;
+	arena->used += size;
+	if(arena->used > arena->high_water)
+		arena->high_water = arena->used;
+	return ptr;
+}
+
+void reset_arena(Arena* arena)
+{
+	ArenaBlock* block = arena->blocks;
+
+	/* more than one block: replace them by one that fits all of it */
+	if(block && block->next) {
+		unsigned int size = block->size;
+		while(size < arena->high_water)
+			size *= 2;
+		while(block) {
+			ArenaBlock* next = block->next;
+			free(block);
+			block = next;
+		}
+		arena->blocks = new_block(size);
+	} else if(block) {
+		block->used = 0;
+	}
+	arena->used = 0;
+}
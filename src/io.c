@@ -26,17 +26,78 @@ int LoadFile(void** out, const char* filename)
 	return size;
 }
 
-int LoadFileFromArchive(void** out, const char* filename)
+int MapFile(void** out, const char* filename, FSMapMode mode)
+{
+	FSFile file;
+	int size;
+
+	FS_InitFile(&file);
+	if(!FS_OpenFile(&file, filename))
+		fatal_error("MapFile: Cannot open file %s!\n", filename);
+
+	size = FS_GetLength(&file);
+	*out = FS_MapFile(&file, mode);
+	if(!*out)
+		fatal_error("MapFile: Failed to map the file %s!\n", filename);
+
+	FS_CloseFile(&file);
+	return size;
+}
+
+void UnmapFile(void* ptr, int size)
+{
+	FS_UnmapFile(ptr, size);
+}
+
+/* size and modification time, the contents are not read */
+int StampFile(FileStamp* stamp, const char* filename)
+{
+	FSFile file;
+
+	FS_InitFile(&file);
+	if(!FS_OpenFile(&file, filename))
+		fatal_error("StampFile: Cannot open file %s!\n", filename);
+
+	memset(stamp, 0, sizeof(FileStamp));
+	stamp->mtime = FS_GetModifiedTime(&file);
+	stamp->size = FS_GetLength(&file);
+	stamp->length = stamp->size;
+
+	FS_CloseFile(&file);
+	return stamp->length;
+}
+
+static const char* split_archive_path(char name[32], const char* filename)
 {
-	char name[32];
-	char* file;
 	char* slash = strchr(filename, '/');
 	if(!slash)
 		fatal_error("LoadFileFromArchive: Failed to get archive name from file %s!\n", filename);
 
 	memcpy(name, filename, (int) (slash - filename));
 	name[(int) (slash - filename)] = 0;
-	file = slash + 1;
+	return slash + 1;
+}
+
+int LoadFileFromArchive(void** out, const char* filename)
+{
+	char name[32];
+	const char* file = split_archive_path(name, filename);
 
 	return LoadFromArchive(out, name, file);
 }
+
+int BorrowFileFromArchive(void** out, const char* filename)
+{
+	char name[32];
+	const char* file = split_archive_path(name, filename);
+
+	return BorrowFromArchive(out, name, file);
+}
+
+int StampFileInArchive(FileStamp* stamp, const char* filename)
+{
+	char name[32];
+	const char* file = split_archive_path(name, filename);
+
+	return StampFromArchive(stamp, name, file);
+}
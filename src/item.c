@@ -10,6 +10,7 @@
 #include "entity.h"
 #include "os.h"
 #include "heap.h"
+#include "loader.h"
 
 extern float xrot, yrot;
 
@@ -53,6 +54,17 @@ static CAnimation* pickup_animations[NUM_PICKUP_MODELS] = { 0 };
 
 static CModel* item_base_model = NULL;
 
+static void pickup_ready(CModel* model, void* arg)
+{
+	char filename[256];
+	int id = (int) (intptr_t) arg;
+
+	if(pickup_has_anim[id] && !pickup_animations[id]) {
+		sprintf(filename, "%s_Anim.bin", pickup_model_names[id]);
+		load_animation(&pickup_animations[id], filename, model, 0);
+	}
+}
+
 static void load_pickup(int id)
 {
 	char filename[256];
@@ -65,11 +77,7 @@ static void load_pickup(int id)
 	if(!pickup_models[id]) {
 		const char* model_name = pickup_model_names[id];
 		sprintf(filename, "%s_Model.bin", model_name);
-		load_model(&pickup_models[id], filename, 0);
-		if(pickup_has_anim[id]) {
-			sprintf(filename, "%s_Anim.bin", pickup_model_names[id]);
-			load_animation(&pickup_animations[id], filename, pickup_models[id], 0);
-		}
+		load_model_async(&pickup_models[id], filename, 0, pickup_ready, (void*) (intptr_t) id);
 	}
 }
 
@@ -186,5 +194,5 @@ void EntItemRegister(void)
 	ent->get_position = CItem_get_position;
 	// ent->set_tex_filter = CItem_set_tex_filter;
 
-	load_model(&item_base_model, "common/items_base_Model.bin", USE_ARCHIVE);
+	load_model_async(&item_base_model, "common/items_base_Model.bin", USE_ARCHIVE, NULL, NULL);
 }
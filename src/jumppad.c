@@ -10,6 +10,7 @@
 #include "entity.h"
 #include "os.h"
 #include "heap.h"
+#include "loader.h"
 
 #ifdef WIN32
 extern PFNGLLOADTRANSPOSEMATRIXFPROC glLoadTransposeMatrixf;
@@ -32,22 +33,35 @@ static CAnimation* jump_pad_anims[NUM_JUMP_PADS] = { 0 };
 static CModel* jump_pad_beam_model = NULL;
 static CAnimation* jump_pad_beam_animation = NULL;
 
-static CModel* jumppad_load_model(EntityJumpPad* jump_pad)
+static void jumppad_ready(CModel* model, void* arg)
+{
+	char filename[256];
+	int model_id = (int) (intptr_t) arg;
+
+	if(!jump_pad_anims[model_id]) {
+		sprintf(filename, "models/%s_Anim.bin", jump_pads[model_id]);
+		load_animation(&jump_pad_anims[model_id], filename, model, 0);
+	}
+}
+
+static void jumppad_beam_ready(CModel* model, void* arg)
+{
+	if(!jump_pad_beam_animation)
+		load_animation(&jump_pad_beam_animation, "models/JumpPad_Beam_Anim.bin", model, 0);
+}
+
+static void jumppad_load_model(EntityJumpPad* jump_pad)
 {
 	char filename[256];
 
 	int model_id = jump_pad->model_id;
 	if(!jump_pad_models[model_id] && jump_pads[model_id]) {
 		sprintf(filename, "models/%s_Model.bin", jump_pads[model_id]);
-		load_model(&jump_pad_models[model_id], filename, 0);
-		sprintf(filename, "models/%s_Anim.bin", jump_pads[model_id]);
-		load_animation(&jump_pad_anims[model_id], filename, jump_pad_models[model_id], 0);
+		load_model_async(&jump_pad_models[model_id], filename, 0, jumppad_ready, (void*) (intptr_t) model_id);
 	}
 
-	if(!jump_pad_beam_model) {
-		load_model(&jump_pad_beam_model, "models/JumpPad_Beam_Model.bin", 0);
-		load_animation(&jump_pad_beam_animation, "models/JumpPad_Beam_Anim.bin", jump_pad_beam_model, 0);
-	}
+	if(!jump_pad_beam_model)
+		load_model_async(&jump_pad_beam_model, "models/JumpPad_Beam_Model.bin", 0, jumppad_beam_ready, NULL);
 }
 
 static void CJumpPad_set_beam_mtx(CJumpPad* self, Mtx44* base)
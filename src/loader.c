@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "types.h"
+#include "error.h"
+#include "heap.h"
+#include "io.h"
+#include "model.h"
+#include "worker.h"
+#include "loader.h"
+
+typedef struct LoadCallback LoadCallback;
+
+struct LoadCallback {
+	LoadCallback*	next;
+	ModelReadyFunc	func;
+	void*		arg;
+};
+
+typedef struct ModelRequest ModelRequest;
+
+struct ModelRequest {
+	ModelRequest*	next;
+	CModel**	target;
+	char		filename[64];
+	int		flags;
+	u8*		data;		/* borrowed from the archive, NULL for loose files */
+	int		size;
+	CModel*		model;
+	Job*		job;
+	LoadCallback*	callbacks;
+	LoadCallback**	last_callback;
+};
+
+static ModelRequest* pending = NULL;
+
+static void add_callback(ModelRequest* req, ModelReadyFunc func, void* arg)
+{
+	LoadCallback* cb;
+
+	if(!func)
+		return;
+
+	cb = (LoadCallback*) alloc_from_heap(sizeof(LoadCallback));
+	cb->next = NULL;
+	cb->func = func;
+	cb->arg = arg;
+	*req->last_callback = cb;
+	req->last_callback = &cb->next;
+}
+
+/* worker thread */
+static void parse_job(void* arg)
+{
+	ModelRequest* req = (ModelRequest*) arg;
+
+	if(req->data)
+		req->model = CModel_parse(req->data, req->size, req->data, req->size, 0xFFFFFFFF);
+	else
+		parse_model(&req->model, req->filename, req->flags);
+}
+
+void load_model_async(CModel** model, const char* filename, int flags, ModelReadyFunc ready, void* arg)
+{
+	ModelRequest* req;
+
+	if(*model) {
+		if(ready)
+			ready(*model, arg);
+		return;
+	}
+
+	for(req = pending; req; req = req->next) {
+		if(req->target == model) {
+			add_callback(req, ready, arg);
+			return;
+		}
+	}
+
+	printf("queueing model %s\n", filename);
+
+	req = (ModelRequest*) alloc_from_heap(sizeof(ModelRequest));
+	if(!req)
+		fatal_error("load_model_async: Not enough memory!\n");
+	req->target = model;
+	strncpy(req->filename, filename, sizeof(req->filename) - 1);
+	req->filename[sizeof(req->filename) - 1] = 0;
+	req->flags = flags;
+	req->data = NULL;
+	req->size = 0;
+	req->model = NULL;
+	req->callbacks = NULL;
+	req->last_callback = &req->callbacks;
+	add_callback(req, ready, arg);
+
+	/* resolve archive entries here, FindArchive may have to wait for a
+	 * decode on the worker pool and must not do so from a worker */
+	if(flags & USE_ARCHIVE)
+		req->size = BorrowFileFromArchive((void**)&req->data, filename);
+
+	req->next = pending;
+	pending = req;
+
+	req->job = WorkerSubmit(parse_job, req);
+}
+
+static void complete_request(ModelRequest* req)
+{
+	LoadCallback* cb;
+	LoadCallback* next;
+
+	WorkerWait(req->job);
+	CModel_upload(req->model);
+	*req->target = req->model;
+
+	for(cb = req->callbacks; cb; cb = next) {
+		next = cb->next;
+		cb->func(req->model, cb->arg);
+		free_to_heap(cb);
+	}
+
+	free_to_heap(req);
+}
+
+/* unlinks all finished requests first, callbacks may queue new ones */
+static void process_requests(int wait)
+{
+	ModelRequest* done = NULL;
+	ModelRequest** link = &pending;
+	ModelRequest* req;
+
+	while((req = *link)) {
+		if(wait || WorkerDone(req->job)) {
+			*link = req->next;
+			req->next = done;
+			done = req;
+		} else {
+			link = &req->next;
+		}
+	}
+
+	while(done) {
+		req = done;
+		done = req->next;
+		complete_request(req);
+	}
+}
+
+void process_async_loads(void)
+{
+	process_requests(0);
+}
+
+void finish_async_loads(void)
+{
+	while(pending)
+		process_requests(1);
+}
@@ -1,65 +1,106 @@
+#include <string.h>
+
 #include "types.h"
 #include "error.h"
 #include "heap.h"
 #include "lzss.h"
 
-#define N		 4096	/* size of ring buffer */
-#define F		   18	/* upper limit for match_length */
 #define THRESHOLD	    2   /* encode string into position and length if match_length is greater than this */
+#define MAX_MATCH	   18	/* upper limit for match_length */
+
+/*
+
+	LZ10 as used by the GBA/DS BIOS
+
+	4 byte header: type (0x10) followed by the 24 bit decompressed size
+	Then blocks of one flag byte (MSB first) and 8 tokens:
+		flag 0: one literal byte
+		flag 1: two bytes, length = (b0 >> 4) + 3, distance = ((b0 & 0xF) << 8 | b1) + 1
 
-int LZDecode(void** output, void* input)
+	Back-references are copied straight out of the output buffer. As long as
+	a whole block (at most 17 input and 144 output bytes) is known to fit, the
+	inner loop runs without any bounds checks; the tail is decoded carefully.
+
+*/
+
+static void copy_match(u8* out, int disp, int len)
 {
-	unsigned char text_buf[N + F - 1];
+	const u8* src = out - disp;
+	if(disp >= len) {
+		memcpy(out, src, len);
+	} else {
+		/* overlapping match, repeats the last disp bytes */
+		while(len--)
+			*(out++) = *(src++);
+	}
+}
 
-	int  i, j, k, r, c, z;
-	unsigned int flags;
+int LZDecode(void** output, const void* input, int input_size)
+{
+	const u8* in = (const u8*) input;
+	const u8* in_end = in + input_size;
 	u32 decomp_size;
-	u32 cur_size = 0;
-	u8* in = (u8*) input;
 	u8* out;
+	u8* out_start;
+	u8* out_end;
+	int i;
+
+	if(input_size < 4 || in[0] != 0x10)
+		fatal_error("LZDecode: Not LZ10 compressed data!\n");
 
-	// read gba header info
-	u32 gbaheader;
-	for(i = 0; i < 4; i++)
-		gbaheader = (gbaheader >> 8) | (*(in++) << 24);
-	decomp_size = gbaheader >> 8;
+	decomp_size = in[1] | (in[2] << 8) | (in[3] << 16);
+	in += 4;
 
 	out = (u8*) alloc_from_heap(decomp_size);
 	if(!out)
 		fatal_error("LZDecode: Not enough memory to allocate %d bytes!\n", decomp_size);
 	*output = out;
+	out_start = out;
+	out_end = out + decomp_size;
 
-	for(i = 0; i < N - F; i++)
-		text_buf[i] = 0xFF;
-	r = N - F;
-	flags = z = 7;
-	while(cur_size < decomp_size) {
-		flags <<= 1;
-		z++;
-		if (z == 8) {				// read new block flag
-			c = *(in++);
-			flags = c;
-			z = 0;				// reset counter
+	/* fast path */
+	while(in_end - in >= 1 + 8 * 2 && out_end - out >= 8 * MAX_MATCH) {
+		u32 flags = *(in++);
+		for(i = 0; i < 8; i++, flags <<= 1) {
+			if(!(flags & 0x80)) {
+				*(out++) = *(in++);
+			} else {
+				int len = (in[0] >> 4) + THRESHOLD + 1;
+				int disp = (((in[0] & 0xF) << 8) | in[1]) + 1;
+				in += 2;
+				if(disp > out - out_start)
+					fatal_error("LZDecode: Back-reference before start of data!\n");
+				copy_match(out, disp, len);
+				out += len;
+			}
 		}
-		if(!(flags & 0x80)) {			// flag bit zero => uncompressed
-			c = *(in++);
-			if(cur_size < decomp_size)
-				*(out++) = c;
-			text_buf[r++] = c;
-			r &= N - 1;
-			cur_size++;
-		} else {
-			i = *(in++);
-			j = *(in++);
-			j = j | ((i << 8) & 0xf00);		// match offset
-			i = ((i >> 4) & 0x0f) + THRESHOLD;	// match length
-			for (k = 0; k <= i; k++) {
-				c = text_buf[(r - j - 1) & (N - 1)];
-				if(cur_size < decomp_size)
-					*(out++) = c;
-				text_buf[r++] = c;
-				r &= N - 1;
-				cur_size++;
+	}
+
+	/* tail */
+	while(out < out_end) {
+		u32 flags;
+		if(in >= in_end)
+			fatal_error("LZDecode: Compressed data is truncated!\n");
+		flags = *(in++);
+		for(i = 0; i < 8 && out < out_end; i++, flags <<= 1) {
+			if(!(flags & 0x80)) {
+				if(in >= in_end)
+					fatal_error("LZDecode: Compressed data is truncated!\n");
+				*(out++) = *(in++);
+			} else {
+				int len, disp;
+				if(in_end - in < 2)
+					fatal_error("LZDecode: Compressed data is truncated!\n");
+				len = (in[0] >> 4) + THRESHOLD + 1;
+				disp = (((in[0] & 0xF) << 8) | in[1]) + 1;
+				in += 2;
+				if(disp > out - out_start)
+					fatal_error("LZDecode: Back-reference before start of data!\n");
+				/* the last match may run past the end, drop the excess */
+				if(len > out_end - out)
+					len = out_end - out;
+				copy_match(out, disp, len);
+				out += len;
 			}
 		}
 	}
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "error.h"
+#include "hash.h"
+#include "model.h"
+#include "meshopt.h"
+
+/*
+
+	Mesh optimisation
+
+	The GX command stream has no index buffer: every strip repeats the
+	vertices it shares with its neighbours and nothing is shared between
+	primitives. After do_dlist has turned a dlist into an indexed triangle
+	list this pass
+		1. welds vertices that are identical in every attribute,
+		2. drops triangles that became degenerate,
+		3. reorders the triangles for the post-transform vertex cache
+		   (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"),
+		4. reorders the vertices in order of first use.
+
+*/
+
+#define CACHE_SIZE		32
+#define CACHE_DECAY_POWER	1.5f
+#define LAST_TRI_SCORE		0.75f
+#define VALENCE_BOOST_SCALE	2.0f
+#define VALENCE_BOOST_POWER	0.5f
+
+static unsigned int weld_vertices(CGeometry* geo, unsigned int* remap)
+{
+	unsigned int i;
+	unsigned int size = 16;
+	unsigned int count = 0;
+	unsigned int* table;
+
+	while(size < geo->num_vertices * 2)
+		size <<= 1;
+
+	table = (unsigned int*) malloc(size * sizeof(unsigned int));
+	if(!table)
+		fatal_error("optimize_geometry: Not enough memory!\n");
+	memset(table, 0xFF, size * sizeof(unsigned int));
+
+	for(i = 0; i < geo->num_vertices; i++) {
+		CVertex* v = &geo->vertices[i];
+		u32 slot = (u32) fnv1a64(v, sizeof(CVertex)) & (size - 1);
+
+		while(table[slot] != ~0u && memcmp(&geo->vertices[table[slot]], v, sizeof(CVertex)))
+			slot = (slot + 1) & (size - 1);
+
+		if(table[slot] == ~0u) {
+			table[slot] = count;
+			geo->vertices[count++] = *v;
+		}
+		remap[i] = table[slot];
+	}
+
+	free(table);
+	return count;
+}
+
+static float vertex_score(int cache_pos, unsigned int active_tris)
+{
+	float score = 0.0f;
+
+	if(!active_tris)
+		return -1.0f;
+
+	if(cache_pos >= 0) {
+		if(cache_pos < 3)
+			score = LAST_TRI_SCORE;
+		else
+			score = powf(1.0f - (cache_pos - 3) * (1.0f / (CACHE_SIZE - 3)), CACHE_DECAY_POWER);
+	}
+
+	return score + VALENCE_BOOST_SCALE * powf((float) active_tris, -VALENCE_BOOST_POWER);
+}
+
+static void reorder_triangles(unsigned int* indices, unsigned int num_tris, unsigned int num_vertices)
+{
+	unsigned int* active = (unsigned int*) calloc(num_vertices, sizeof(unsigned int));
+	unsigned int* offsets = (unsigned int*) malloc((num_vertices + 1) * sizeof(unsigned int));
+	unsigned int* adjacency = (unsigned int*) malloc(num_tris * 3 * sizeof(unsigned int));
+	int* cache_pos = (int*) malloc(num_vertices * sizeof(int));
+	float* score = (float*) malloc(num_vertices * sizeof(float));
+	float* tri_score = (float*) malloc(num_tris * sizeof(float));
+	u8* emitted = (u8*) calloc(num_tris, 1);
+	unsigned int* out = (unsigned int*) malloc(num_tris * 3 * sizeof(unsigned int));
+	unsigned int cache[CACHE_SIZE + 3];
+	unsigned int cache_count = 0;
+	unsigned int i, j, k;
+	unsigned int emitted_count = 0;
+	unsigned int scan = 0;
+	int best = -1;
+
+	if(!active || !offsets || !adjacency || !cache_pos || !score || !tri_score || !emitted || !out)
+		fatal_error("optimize_geometry: Not enough memory!\n");
+
+	/* vertex -> triangle adjacency */
+	for(i = 0; i < num_tris * 3; i++)
+		active[indices[i]]++;
+	offsets[0] = 0;
+	for(i = 0; i < num_vertices; i++)
+		offsets[i + 1] = offsets[i] + active[i];
+	for(i = 0; i < num_tris * 3; i++) {
+		unsigned int v = indices[i];
+		adjacency[offsets[v + 1] - active[v]] = i / 3;
+		active[v]--;
+	}
+	for(i = 0; i < num_vertices; i++) {
+		active[i] = offsets[i + 1] - offsets[i];
+		cache_pos[i] = -1;
+		score[i] = vertex_score(-1, active[i]);
+	}
+	for(i = 0; i < num_tris; i++)
+		tri_score[i] = score[indices[i * 3]] + score[indices[i * 3 + 1]] + score[indices[i * 3 + 2]];
+
+	while(emitted_count < num_tris) {
+		unsigned int new_cache[CACHE_SIZE + 3];
+		unsigned int new_count = 0;
+		unsigned int* tri;
+		float best_score;
+
+		if(best < 0) {
+			/* nothing in the cache left, continue with the best remaining triangle */
+			best_score = -1.0f;
+			while(emitted[scan])
+				scan++;
+			for(i = scan; i < num_tris; i++) {
+				if(!emitted[i] && tri_score[i] > best_score) {
+					best_score = tri_score[i];
+					best = i;
+				}
+			}
+		}
+
+		tri = &indices[best * 3];
+		memcpy(&out[emitted_count * 3], tri, 3 * sizeof(unsigned int));
+		emitted[best] = 1;
+		emitted_count++;
+
+		/* remove the triangle from its vertices' lists of remaining triangles */
+		for(j = 0; j < 3; j++) {
+			unsigned int v = tri[j];
+			unsigned int* adj = &adjacency[offsets[v]];
+			for(k = 0; k < active[v]; k++) {
+				if(adj[k] == (unsigned int) best) {
+					adj[k] = adj[active[v] - 1];
+					break;
+				}
+			}
+			active[v]--;
+			new_cache[new_count++] = v;
+		}
+
+		/* LRU cache, the triangle's vertices move to the front */
+		for(i = 0; i < cache_count; i++) {
+			unsigned int v = cache[i];
+			if(v != tri[0] && v != tri[1] && v != tri[2])
+				new_cache[new_count++] = v;
+		}
+
+		best = -1;
+		best_score = -1.0f;
+		for(i = 0; i < new_count; i++) {
+			unsigned int v = new_cache[i];
+			cache_pos[v] = i < CACHE_SIZE ? (int) i : -1;
+			score[v] = vertex_score(cache_pos[v], active[v]);
+		}
+		for(i = 0; i < new_count; i++) {
+			unsigned int v = new_cache[i];
+			for(k = 0; k < active[v]; k++) {
+				unsigned int t = adjacency[offsets[v] + k];
+				tri_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+				if(tri_score[t] > best_score) {
+					best_score = tri_score[t];
+					best = t;
+				}
+			}
+		}
+
+		cache_count = new_count < CACHE_SIZE ? new_count : CACHE_SIZE;
+		memcpy(cache, new_cache, cache_count * sizeof(unsigned int));
+	}
+
+	memcpy(indices, out, num_tris * 3 * sizeof(unsigned int));
+
+	free(active);
+	free(offsets);
+	free(adjacency);
+	free(cache_pos);
+	free(score);
+	free(tri_score);
+	free(emitted);
+	free(out);
+}
+
+/* puts the vertices in the order the index buffer first uses them */
+static void reorder_vertices(CGeometry* geo)
+{
+	unsigned int i;
+	unsigned int count = 0;
+	unsigned int* remap = (unsigned int*) malloc(geo->num_vertices * sizeof(unsigned int));
+	CVertex* vertices = (CVertex*) malloc(geo->num_vertices * sizeof(CVertex));
+
+	if(!remap || !vertices)
+		fatal_error("optimize_geometry: Not enough memory!\n");
+	memset(remap, 0xFF, geo->num_vertices * sizeof(unsigned int));
+
+	for(i = 0; i < geo->num_indices; i++) {
+		unsigned int v = geo->indices[i];
+		if(remap[v] == ~0u) {
+			remap[v] = count;
+			vertices[count++] = geo->vertices[v];
+		}
+		geo->indices[i] = remap[v];
+	}
+
+	free(geo->vertices);
+	free(remap);
+	geo->vertices = vertices;
+	geo->num_vertices = count;
+}
+
+void optimize_geometry(CGeometry* geo, MeshOptStats* stats)
+{
+	unsigned int i;
+	unsigned int num_indices = 0;
+	unsigned int* remap;
+
+	stats->vertices_in += geo->num_vertices;
+	stats->triangles_in += geo->num_indices / 3;
+
+	if(geo->num_vertices) {
+		remap = (unsigned int*) malloc(geo->num_vertices * sizeof(unsigned int));
+		if(!remap)
+			fatal_error("optimize_geometry: Not enough memory!\n");
+		geo->num_vertices = weld_vertices(geo, remap);
+
+		for(i = 0; i < geo->num_indices; i += 3) {
+			unsigned int a = remap[geo->indices[i]];
+			unsigned int b = remap[geo->indices[i + 1]];
+			unsigned int c = remap[geo->indices[i + 2]];
+			if(a == b || b == c || a == c)
+				continue;
+			geo->indices[num_indices++] = a;
+			geo->indices[num_indices++] = b;
+			geo->indices[num_indices++] = c;
+		}
+		geo->num_indices = num_indices;
+		free(remap);
+
+		if(num_indices) {
+			reorder_triangles(geo->indices, num_indices / 3, geo->num_vertices);
+			reorder_vertices(geo);
+		} else {
+			geo->num_vertices = 0;
+		}
+	}
+
+	stats->vertices_out += geo->num_vertices;
+	stats->triangles_out += geo->num_indices / 3;
+}
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <malloc.h>
 #include <float.h>
+#include <stddef.h>
 #include <math.h>
 #include <GL/gl.h>
 #include <GL/glext.h> // for mingw
@@ -26,6 +27,14 @@
 #include "os.h"
 
 #include "game.h"
+#include "bake.h"
+#include "meshopt.h"
+#include "cull.h"
+#include "occlusion.h"
+#include "texdecode.h"
+#include "texcache.h"
+#include "hash.h"
+#include "glstate.h"
 
 #ifdef _DEBUG
 #	ifdef WIN32
@@ -229,11 +238,33 @@ PFNGLUSEPROGRAMPROC		glUseProgram;
 PFNGLGETUNIFORMLOCATIONPROC	glGetUniformLocation;
 PFNGLUNIFORM1IPROC		glUniform1i;
 PFNGLUNIFORM1FPROC		glUniform1f;
+PFNGLUNIFORM2FPROC		glUniform2f;
 PFNGLUNIFORM3FVPROC		glUniform3fv;
 PFNGLUNIFORM4FVPROC		glUniform4fv;
 PFNGLUNIFORMMATRIX4FVPROC	glUniformMatrix4fv;
 PFNGLLOADTRANSPOSEMATRIXFPROC	glLoadTransposeMatrixf;
 PFNGLMULTTRANSPOSEMATRIXFPROC	glMultTransposeMatrixf;
+PFNGLBINDATTRIBLOCATIONPROC	glBindAttribLocation;
+PFNGLGENBUFFERSPROC		glGenBuffers;
+PFNGLDELETEBUFFERSPROC		glDeleteBuffers;
+PFNGLBINDBUFFERPROC		glBindBuffer;
+PFNGLBUFFERDATAPROC		glBufferData;
+PFNGLBUFFERSUBDATAPROC		glBufferSubData;
+PFNGLVERTEXATTRIBPOINTERPROC	glVertexAttribPointer;
+PFNGLENABLEVERTEXATTRIBARRAYPROC	glEnableVertexAttribArray;
+PFNGLDISABLEVERTEXATTRIBARRAYPROC	glDisableVertexAttribArray;
+PFNGLACTIVETEXTUREPROC		glActiveTexture;
+PFNGLGENFRAMEBUFFERSPROC	glGenFramebuffers;
+PFNGLBINDFRAMEBUFFERPROC	glBindFramebuffer;
+PFNGLFRAMEBUFFERRENDERBUFFERPROC	glFramebufferRenderbuffer;
+PFNGLCHECKFRAMEBUFFERSTATUSPROC	glCheckFramebufferStatus;
+PFNGLBLITFRAMEBUFFERPROC	glBlitFramebuffer;
+PFNGLGENRENDERBUFFERSPROC	glGenRenderbuffers;
+PFNGLBINDRENDERBUFFERPROC	glBindRenderbuffer;
+PFNGLRENDERBUFFERSTORAGEPROC	glRenderbufferStorage;
+PFNGLFRAMEBUFFERTEXTURE2DPROC	glFramebufferTexture2D;
+PFNGLDRAWBUFFERSPROC		glDrawBuffers;
+PFNGLBLENDFUNCSEPARATEPROC	glBlendFuncSeparate;
 
 static void load_extensions(void)
 {
@@ -254,11 +285,33 @@ static void load_extensions(void)
 	glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)wglGetProcAddress("glGetUniformLocation");
 	glUniform1i = (PFNGLUNIFORM1IPROC)wglGetProcAddress("glUniform1i");
 	glUniform1f = (PFNGLUNIFORM1FPROC)wglGetProcAddress("glUniform1f");
+	glUniform2f = (PFNGLUNIFORM2FPROC)wglGetProcAddress("glUniform2f");
 	glUniform3fv = (PFNGLUNIFORM3FVPROC)wglGetProcAddress("glUniform3fv");
 	glUniform4fv = (PFNGLUNIFORM4FVPROC)wglGetProcAddress("glUniform4fv");
 	glUniformMatrix4fv = (PFNGLUNIFORMMATRIX4FVPROC)wglGetProcAddress("glUniformMatrix4fv");
 	glLoadTransposeMatrixf = (PFNGLLOADTRANSPOSEMATRIXFPROC)wglGetProcAddress("glLoadTransposeMatrixf");
 	glMultTransposeMatrixf = (PFNGLMULTTRANSPOSEMATRIXFPROC)wglGetProcAddress("glMultTransposeMatrixf");
+	glBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)wglGetProcAddress("glBindAttribLocation");
+	glGenBuffers = (PFNGLGENBUFFERSPROC)wglGetProcAddress("glGenBuffers");
+	glDeleteBuffers = (PFNGLDELETEBUFFERSPROC)wglGetProcAddress("glDeleteBuffers");
+	glBindBuffer = (PFNGLBINDBUFFERPROC)wglGetProcAddress("glBindBuffer");
+	glBufferData = (PFNGLBUFFERDATAPROC)wglGetProcAddress("glBufferData");
+	glBufferSubData = (PFNGLBUFFERSUBDATAPROC)wglGetProcAddress("glBufferSubData");
+	glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)wglGetProcAddress("glVertexAttribPointer");
+	glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glEnableVertexAttribArray");
+	glDisableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)wglGetProcAddress("glDisableVertexAttribArray");
+	glActiveTexture = (PFNGLACTIVETEXTUREPROC)wglGetProcAddress("glActiveTexture");
+	glGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)wglGetProcAddress("glGenFramebuffers");
+	glBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)wglGetProcAddress("glBindFramebuffer");
+	glFramebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)wglGetProcAddress("glFramebufferRenderbuffer");
+	glCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)wglGetProcAddress("glCheckFramebufferStatus");
+	glBlitFramebuffer = (PFNGLBLITFRAMEBUFFERPROC)wglGetProcAddress("glBlitFramebuffer");
+	glGenRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)wglGetProcAddress("glGenRenderbuffers");
+	glBindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC)wglGetProcAddress("glBindRenderbuffer");
+	glRenderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)wglGetProcAddress("glRenderbufferStorage");
+	glFramebufferTexture2D = (PFNGLFRAMEBUFFERTEXTURE2DPROC)wglGetProcAddress("glFramebufferTexture2D");
+	glDrawBuffers = (PFNGLDRAWBUFFERSPROC)wglGetProcAddress("glDrawBuffers");
+	glBlendFuncSeparate = (PFNGLBLENDFUNCSEPARATEPROC)wglGetProcAddress("glBlendFuncSeparate");
 }
 #endif
 
@@ -277,6 +330,13 @@ uniform mat4 view; \n\
 uniform mat4 texcoordmtx; \n\
 uniform mat4[32] mtx_stack; \n\
 \n\
+uniform float pos_scale; \n\
+\n\
+attribute vec4 in_position; \n\
+attribute vec2 in_texcoord; \n\
+attribute vec3 in_normal; \n\
+attribute vec4 in_color; \n\
+\n\
 varying vec2 texcoord; \n\
 varying vec4 color; \n\
 \n\
@@ -295,19 +355,20 @@ vec3 light_calc(vec3 light_vec, vec3 light_col, vec3 normal_vec, vec3 dif_col, v
 \n\
 void main() \n\
 { \n\
-	mat4 model = mtx_stack[int(gl_MultiTexCoord0.z)]; \n\
-	gl_Position = projection * view * model * gl_Vertex; \n\
+	mat4 model = mtx_stack[int(in_position.w)]; \n\
+	vec4 vtx_color = in_color.a > 1.5 ? vec4(diffuse, 1.0) : vec4(in_color.rgb / 31.0, in_color.a); \n\
+	gl_Position = projection * view * model * vec4(in_position.xyz * pos_scale, 1.0); \n\
 	if(use_light) { \n\
-		vec3 normal = normalize(mat3(model) * gl_Normal); \n\
-		vec3 dif = gl_Color.a < 0.5 ? gl_Color.rgb : diffuse; \n\
-		vec3 amb = gl_Color.a < 0.5 ? vec3(0.0, 0.0, 0.0) : ambient; \n\
+		vec3 normal = normalize(mat3(model) * in_normal); \n\
+		vec3 dif = vtx_color.a < 0.5 ? vtx_color.rgb : diffuse; \n\
+		vec3 amb = vtx_color.a < 0.5 ? vec3(0.0, 0.0, 0.0) : ambient; \n\
 		vec3 col1 = light_calc(light1vec, light1col, normal, dif, amb, specular); \n\
 		vec3 col2 = light_calc(light2vec, light2col, normal, dif, amb, specular); \n\
 		color = vec4(min((col1 + col2), vec3(1.0, 1.0, 1.0)), 1.0); \n\
 	} else { \n\
-		color = vec4(gl_Color.rgb, 1.0); \n\
+		color = vec4(vtx_color.rgb, 1.0); \n\
 	} \n\
-	texcoord = vec2(texcoordmtx * vec4(gl_MultiTexCoord0.xy, 0, 1)); \n\
+	texcoord = vec2(texcoordmtx * vec4(in_texcoord / 16.0, 0, 1)); \n\
 }";
 const char* fragment_shader = "\
 #version 120 \n\
@@ -318,6 +379,11 @@ uniform float fog_min; \n\
 uniform float fog_max; \n\
 uniform float alpha_scale; \n\
 uniform sampler2D tex; \n\
+uniform bool use_palette; \n\
+uniform sampler2D palette; \n\
+uniform vec2 tex_size; \n\
+uniform bool tex_filter; \n\
+uniform bool oit; \n\
 varying vec2 texcoord; \n\
 varying vec4 color; \n\
 uniform float mat_alpha; \n\
@@ -329,11 +395,34 @@ vec4 toon_color(vec4 vtx_color) \n\
 	return vec4(toon_table[int(vtx_color.r * 31)], vtx_color.a); \n\
 } \n\
 \n\
+vec4 palette_color(vec2 uv) \n\
+{ \n\
+	float index = floor(texture2D(tex, uv).r * 255.0 + 0.5); \n\
+	return texture2D(palette, vec2((index + 0.5) / 256.0, 0.5)); \n\
+} \n\
+\n\
+vec4 texture_color(vec2 uv) \n\
+{ \n\
+	if(!use_palette) \n\
+		return texture2D(tex, uv); \n\
+	if(!tex_filter) \n\
+		return palette_color(uv); \n\
+	// indices can not be interpolated, filter the four colours instead \n\
+	vec2 st = uv * tex_size - 0.5; \n\
+	vec2 f = fract(st); \n\
+	vec2 base = (floor(st) + 0.5) / tex_size; \n\
+	vec2 d = 1.0 / tex_size; \n\
+	return mix( \n\
+		mix(palette_color(base), palette_color(base + vec2(d.x, 0.0)), f.x), \n\
+		mix(palette_color(base + vec2(0.0, d.y)), palette_color(base + d), f.x), \n\
+		f.y); \n\
+} \n\
+\n\
 void main() \n\
 { \n\
 	vec4 col; \n\
 	if(use_texture) { \n\
-		vec4 texcolor = texture2D(tex, texcoord); \n\
+		vec4 texcolor = texture_color(texcoord); \n\
 		if (mat_mode == 1) { \n\
 			col = vec4( \n\
 				(texcolor.r * texcolor.a + color.r * (1 - texcolor.a)), \n\
@@ -360,15 +449,58 @@ void main() \n\
 			// MPH fog table has min 0 and max 124 \n\
 			density = (depth - fog_min) / (fog_max - fog_min) * 124.0 / 128.0; \n\
 		} \n\
-		gl_FragColor = vec4((col * (1.0 - density) + fog_color * density).xyz, col.a * alpha_scale); \n\
+		col = vec4((col * (1.0 - density) + fog_color * density).xyz, col.a * alpha_scale); \n\
+	} else { \n\
+		col = col * vec4(1.0, 1.0, 1.0, alpha_scale); \n\
+	} \n\
+	if(oit) { \n\
+		// weighted blended translucency, nearer layers weigh more \n\
+		float w = clamp(3e3 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3); \n\
+		gl_FragData[0] = vec4(col.rgb * col.a * w, col.a); \n\
+		gl_FragData[1] = vec4(col.a * w, 0.0, 0.0, 0.0); \n\
 	} else { \n\
-		gl_FragColor = col * vec4(1.0, 1.0, 1.0, alpha_scale); \n\
+		gl_FragData[0] = col; \n\
 	} \n\
 }";
 
+/* resolves the weighted sums of the translucent layers over the frame */
+const char* composite_vertex_shader = "\
+#version 120 \n\
+varying vec2 texcoord; \n\
+\n\
+void main() \n\
+{ \n\
+	texcoord = gl_Vertex.xy * 0.5 + 0.5; \n\
+	gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0); \n\
+}";
+const char* composite_fragment_shader = "\
+#version 120 \n\
+uniform sampler2D accum; \n\
+uniform sampler2D accum_alpha; \n\
+varying vec2 texcoord; \n\
+\n\
+void main() \n\
+{ \n\
+	// alpha is the product of (1 - alpha) of all layers, what still shows through \n\
+	vec4 sum = texture2D(accum, texcoord); \n\
+	if(sum.a >= 1.0) \n\
+		discard; \n\
+	float weight = texture2D(accum_alpha, texcoord).r; \n\
+	gl_FragColor = vec4(sum.rgb / max(weight, 1e-5), sum.a); \n\
+}";
+
+/* vertex attribute locations, bound before linking */
+#define ATTR_POSITION	0
+#define ATTR_TEXCOORD	1
+#define ATTR_NORMAL	2
+#define ATTR_COLOR	3
+
 static GLuint shader;
 static GLuint use_light;
 static GLuint use_texture;
+static GLuint use_palette;
+static GLuint tex_size;
+static GLuint tex_filter;
 static GLuint fog_enable;
 static GLuint light1vec;
 static GLuint light2vec;
@@ -388,6 +520,16 @@ static GLuint texcoord_matrix;
 static GLuint mat_alpha;
 static GLuint mat_mode;
 static GLuint toon_table;
+static GLuint pos_scale;
+static GLuint oit_enable;
+static GLuint composite_shader;
+
+/* palettised textures are uploaded as indices and looked up in the shader */
+static bool indexed_textures = false;
+/* translucency restores the opaque depth from a copy instead of drawing it again */
+static bool depth_snapshots = false;
+/* float render targets for weighted blended translucency */
+static bool oit_targets = false;
 
 static float l1v[3];
 static float l1c[3];
@@ -426,78 +568,88 @@ void CModel_setFogDisable(bool dis)
 	fogdis = dis;
 }
 
-void CModel_init(void)
+static GLuint compile_shader(GLenum type, const char* source)
 {
-#ifdef _WIN32
-	load_extensions();
-#endif
-
-	GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vs, 1, &vertex_shader, 0);
-	glCompileShader(vs);
+	GLuint sh = glCreateShader(type);
+	glShaderSource(sh, 1, &source, 0);
+	glCompileShader(sh);
 
 	GLint compiled = 0;
-	glGetShaderiv(vs, GL_COMPILE_STATUS, &compiled);
+	glGetShaderiv(sh, GL_COMPILE_STATUS, &compiled);
 	if(compiled == GL_FALSE) {
 		GLint len = 0;
-		glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &len);
+		glGetShaderiv(sh, GL_INFO_LOG_LENGTH, &len);
 
 		if(!len)
 			fatal("Failed to retrieve shader compilation error log");
 
 		char* log = (char*)malloc(len);
-		glGetShaderInfoLog(vs, len, &len, log);
-		glDeleteShader(vs);
+		glGetShaderInfoLog(sh, len, &len, log);
+		glDeleteShader(sh);
 
 		fatal(log);
 	}
+	return sh;
+}
 
-	GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fs, 1, &fragment_shader, 0);
-	glCompileShader(fs);
-
-	glGetShaderiv(fs, GL_COMPILE_STATUS, &compiled);
-	if(compiled == GL_FALSE) {
-		GLint len = 0;
-		glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &len);
-
-		if(!len)
-			fatal("Failed to retrieve shader compilation error log");
-
-		char* log = (char*)malloc(len);
-		glGetShaderInfoLog(fs, len, &len, log);
-		glDeleteShader(fs);
-
-		fatal(log);
+static GLuint link_program(const char* vs_source, const char* fs_source, bool attributes)
+{
+	GLuint vs = compile_shader(GL_VERTEX_SHADER, vs_source);
+	GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fs_source);
+	GLuint program = glCreateProgram();
+
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	if(attributes) {
+		glBindAttribLocation(program, ATTR_POSITION, "in_position");
+		glBindAttribLocation(program, ATTR_TEXCOORD, "in_texcoord");
+		glBindAttribLocation(program, ATTR_NORMAL, "in_normal");
+		glBindAttribLocation(program, ATTR_COLOR, "in_color");
 	}
-
-	shader = glCreateProgram();
-
-	glAttachShader(shader, vs);
-	glAttachShader(shader, fs);
-	glLinkProgram(shader);
+	glLinkProgram(program);
 
 	GLint linked = 0;
-	glGetProgramiv(shader, GL_LINK_STATUS, (int*)&linked);
+	glGetProgramiv(program, GL_LINK_STATUS, (int*)&linked);
 	if(linked == GL_FALSE) {
 		GLint len = 0;
-		glGetProgramiv(shader, GL_INFO_LOG_LENGTH, &len);
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
 
 		char* log = (char*)malloc(len);
-		glGetProgramInfoLog(shader, len, &len, log);
+		glGetProgramInfoLog(program, len, &len, log);
 
-		glDeleteProgram(shader);
+		glDeleteProgram(program);
 		glDeleteShader(vs);
 		glDeleteShader(fs);
 
 		fatal(log);
 	}
 
-	glDetachShader(shader, vs);
-	glDetachShader(shader, fs);
+	glDetachShader(program, vs);
+	glDetachShader(program, fs);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	return program;
+}
+
+/* decided by CModel_init, CModel_parse decodes palettised textures for it */
+bool CModel_indexed_textures(void)
+{
+	return indexed_textures;
+}
+
+void CModel_init(void)
+{
+#ifdef _WIN32
+	load_extensions();
+#endif
+
+	shader = link_program(vertex_shader, fragment_shader, true);
 
 	use_light = glGetUniformLocation(shader, "use_light");
 	use_texture = glGetUniformLocation(shader, "use_texture");
+	use_palette = glGetUniformLocation(shader, "use_palette");
+	tex_size = glGetUniformLocation(shader, "tex_size");
+	tex_filter = glGetUniformLocation(shader, "tex_filter");
 	fog_enable = glGetUniformLocation(shader, "fog_enable");
 	light1vec = glGetUniformLocation(shader, "light1vec");
 	light1col = glGetUniformLocation(shader, "light1col");
@@ -517,23 +669,36 @@ void CModel_init(void)
 	mat_alpha = glGetUniformLocation(shader, "mat_alpha");
 	mat_mode = glGetUniformLocation(shader, "mat_mode");
 	toon_table = glGetUniformLocation(shader, "toon_table");
-}
+	pos_scale = glGetUniformLocation(shader, "pos_scale");
+	oit_enable = glGetUniformLocation(shader, "oit");
 
-unsigned int crc32(u8* data, u32 len) {
-	int i, j;
-	unsigned int byte, crc, mask;
+	/* palettes of indexed textures are bound to the second unit */
+	glUseProgram(shader);
+	glUniform1i(glGetUniformLocation(shader, "palette"), 1);
+	glUseProgram(0);
 
-	i = 0;
-	crc = 0xFFFFFFFF;
-	while(len--) {
-		crc = crc ^ data[i];
-		for (j = 7; j >= 0; j--) {
-			mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & mask);
-		}
-		i++;
+	const char* version = (const char*) glGetString(GL_VERSION);
+	const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+	indexed_textures = (version && atoi(version) >= 3) || (extensions && strstr(extensions, "GL_ARB_texture_rg"));
+	if(!indexed_textures)
+		printf("no GL_R8 textures, palettised textures are decoded to RGBA\n");
+
+	depth_snapshots = (version && atoi(version) >= 3) || (extensions && strstr(extensions, "GL_ARB_framebuffer_object"));
+
+	/* the translucent layers are summed in the snapshot's depth */
+	GLint draw_buffers = 0;
+	glGetIntegerv(GL_MAX_DRAW_BUFFERS, &draw_buffers);
+	oit_targets = depth_snapshots && draw_buffers >= 2 &&
+		((version && atoi(version) >= 3) || (extensions && strstr(extensions, "GL_ARB_texture_float")));
+	if(oit_targets) {
+		composite_shader = link_program(composite_vertex_shader, composite_fragment_shader, false);
+		glUseProgram(composite_shader);
+		glUniform1i(glGetUniformLocation(composite_shader, "accum"), 0);
+		glUniform1i(glGetUniformLocation(composite_shader, "accum_alpha"), 1);
+		glUseProgram(0);
+	} else {
+		printf("no float render targets, translucency is sorted by stencil only\n");
 	}
-	return ~crc;
 }
 
 #ifdef TEXDUMP
@@ -594,26 +759,149 @@ static TEXOVERRIDE mtl_overrides[NUM_OVERRIDES] = {
 
 static void update_bounds(CModel* scene, float vtx_state[3])
 {
-	if(vtx_state[0] < scene->min_x) {
+	/* no else: the first vertex has to set both min and max */
+	if(vtx_state[0] < scene->min_x)
 		scene->min_x = vtx_state[0];
-	} else if(vtx_state[0] > scene->max_x) {
+	if(vtx_state[0] > scene->max_x)
 		scene->max_x = vtx_state[0];
-	}
-	if(vtx_state[1] < scene->min_y) {
+	if(vtx_state[1] < scene->min_y)
 		scene->min_y = vtx_state[1];
-	} else if(vtx_state[1] > scene->max_y) {
+	if(vtx_state[1] > scene->max_y)
 		scene->max_y = vtx_state[1];
-	}
-	if(vtx_state[2] < scene->min_z) {
-		scene->min_z = vtx_state[0];
-	} else if(vtx_state[2] > scene->max_z) {
+	if(vtx_state[2] < scene->min_z)
+		scene->min_z = vtx_state[2];
+	if(vtx_state[2] > scene->max_z)
 		scene->max_z = vtx_state[2];
+}
+
+/* arrays of baked models live in the file mapping and must not be freed */
+static void model_free(CModel* scene, void* ptr)
+{
+	if(scene->baked && (u8*) ptr >= scene->baked && (u8*) ptr < scene->baked + scene->baked_size)
+		return;
+	free(ptr);
+}
+
+typedef struct {
+	CGeometry*	geo;
+	unsigned int	max_vertices;
+	unsigned int	max_indices;
+	int		in_primitive;
+	unsigned int	prim_type;
+	unsigned int	prim_first;
+	float		vtx[3];
+	float		uv[2];
+	unsigned int	mtx_id;
+	float		normal[3];
+	float		color[4];
+	unsigned int	flags;
+} DlistState;
+
+static void emit_vertex(DlistState* st, CModel* scene)
+{
+	CGeometry* geo = st->geo;
+	CVertex* v;
+
+	if(geo->num_vertices == st->max_vertices) {
+		st->max_vertices = st->max_vertices ? st->max_vertices * 2 : 64;
+		geo->vertices = (CVertex*) realloc(geo->vertices, st->max_vertices * sizeof(CVertex));
+		if(!geo->vertices)
+			fatal("not enough memory");
+	}
+
+	v = &geo->vertices[geo->num_vertices++];
+	v->pos[0] = st->vtx[0];
+	v->pos[1] = st->vtx[1];
+	v->pos[2] = st->vtx[2];
+	v->uv[0] = st->uv[0];
+	v->uv[1] = st->uv[1];
+	v->uv[2] = (float) st->mtx_id;
+	memcpy(v->normal, st->normal, sizeof(v->normal));
+	memcpy(v->color, st->color, sizeof(v->color));
+	v->flags = st->flags;
+	/* without a NORMAL the GL default applies, without a COLOR the material diffuse (alpha < 0, see vertex shader) */
+	if(!(v->flags & VTX_HAS_NORMAL)) {
+		v->normal[0] = 0.0f;
+		v->normal[1] = 0.0f;
+		v->normal[2] = 1.0f;
+	}
+	if(!(v->flags & VTX_HAS_COLOR))
+		v->color[3] = -1.0f;
+
+	update_bounds(scene, st->vtx);
+}
+
+static void begin_primitive(DlistState* st, unsigned int type)
+{
+	st->prim_type = type;
+	st->prim_first = st->geo->num_vertices;
+	st->in_primitive = 1;
+}
+
+static void emit_triangle(DlistState* st, unsigned int a, unsigned int b, unsigned int c)
+{
+	CGeometry* geo = st->geo;
+	unsigned int* idx;
+
+	if(geo->num_indices + 3 > st->max_indices) {
+		st->max_indices *= 2;
+		geo->indices = (unsigned int*) realloc(geo->indices, st->max_indices * sizeof(unsigned int));
+		if(!geo->indices)
+			fatal("not enough memory");
 	}
+
+	idx = &geo->indices[geo->num_indices];
+	idx[0] = a;
+	idx[1] = b;
+	idx[2] = c;
+	geo->num_indices += 3;
 }
 
-static void do_reg(u32 reg, u32** data_pp, float vtx_state[3], float uv_state[2], unsigned int* mtx_id, CModel* scene)
+/* turns the vertices of the current primitive into triangles with the winding GL would use */
+static void end_primitive(DlistState* st)
+{
+	unsigned int first = st->prim_first;
+	unsigned int count;
+	unsigned int i;
+
+	if(!st->in_primitive)
+		return;
+	st->in_primitive = 0;
+
+	count = st->geo->num_vertices - first;
+	switch(st->prim_type) {
+		case 0: /* triangles */
+			for(i = 0; i + 3 <= count; i += 3)
+				emit_triangle(st, first + i, first + i + 1, first + i + 2);
+			break;
+		case 1: /* quads */
+			for(i = 0; i + 4 <= count; i += 4) {
+				emit_triangle(st, first + i, first + i + 1, first + i + 2);
+				emit_triangle(st, first + i, first + i + 2, first + i + 3);
+			}
+			break;
+		case 2: /* triangle strip */
+			for(i = 0; i + 3 <= count; i++) {
+				if(i & 1)
+					emit_triangle(st, first + i + 1, first + i, first + i + 2);
+				else
+					emit_triangle(st, first + i, first + i + 1, first + i + 2);
+			}
+			break;
+		case 3: /* quad strip */
+			for(i = 0; i + 4 <= count; i += 2) {
+				emit_triangle(st, first + i, first + i + 1, first + i + 3);
+				emit_triangle(st, first + i, first + i + 3, first + i + 2);
+			}
+			break;
+	}
+}
+
+static void do_reg(u32 reg, u32** data_pp, DlistState* st, CModel* scene)
 {
 	u32* data = *data_pp;
+	float* vtx_state = st->vtx;
+	float* uv_state = st->uv;
 
 	switch(reg) {
 		//NOP
@@ -623,158 +911,151 @@ static void do_reg(u32 reg, u32** data_pp, float vtx_state[3], float uv_state[2]
 
 		//MTX_RESTORE
 		case 0x450: {
-			u32 index = *(data++);
+			u32 index = get32bit_LE((u8*)data++);
 			// e.g. rooms don't use weight IDs, so keep the index at 0
 			if (scene->num_node_weight > 0) {
-				*mtx_id = index;
+				st->mtx_id = index;
 			}
-			glTexCoord3f(uv_state[0], uv_state[1], (float)(*mtx_id));
 		}
 		break;
 
 		//COLOR
 		case 0x480: {
-			u32 rgb = *(data++);
+			u32 rgb = get32bit_LE((u8*)data++);
 			u32 r = (rgb >>  0) & 0x1F;
 			u32 g = (rgb >>  5) & 0x1F;
 			u32 b = (rgb >> 10) & 0x1F;
-			glColor3f(((float)r) / 31.0f, ((float)g) / 31.0f, ((float)b) / 31.0f);
+			st->color[0] = ((float)r) / 31.0f;
+			st->color[1] = ((float)g) / 31.0f;
+			st->color[2] = ((float)b) / 31.0f;
+			st->color[3] = 1.0f;
+			st->flags |= VTX_HAS_COLOR;
 		}
 		break;
 
 		//NORMAL
 		case 0x484: {
-			u32 xyz = *(data++);
+			u32 xyz = get32bit_LE((u8*)data++);
 			s32 x = (xyz >>  0) & 0x3FF;			if(x & 0x200)			x |= 0xFFFFFC00;
 			s32 y = (xyz >> 10) & 0x3FF;			if(y & 0x200)			y |= 0xFFFFFC00;
 			s32 z = (xyz >> 20) & 0x3FF;			if(z & 0x200)			z |= 0xFFFFFC00;
-			glNormal3f(((float)x) / 512.0f, ((float)y) / 512.0f, ((float)z) / 512.0f);
+			st->normal[0] = ((float)x) / 512.0f;
+			st->normal[1] = ((float)y) / 512.0f;
+			st->normal[2] = ((float)z) / 512.0f;
+			st->flags |= VTX_HAS_NORMAL;
 		}
 		break;
 
 		//TEXCOORD
 		case 0x488: {
-			u32 st = *(data++);
+			u32 st = get32bit_LE((u8*)data++);
 			s32 s = (st >>  0) & 0xFFFF;			if(s & 0x8000)		s |= 0xFFFF0000;
 			s32 t = (st >> 16) & 0xFFFF;			if(t & 0x8000)		t |= 0xFFFF0000;
 			uv_state[0] = ((float)s) / 16.0f;
 			uv_state[1] = ((float)t) / 16.0f;
-			glTexCoord3f(uv_state[0], uv_state[1], (float)(*mtx_id));
 		}
 		break;
 
 		//VTX_16
 		case 0x48C: {
-			u32 xy = *(data++);
+			u32 xy = get32bit_LE((u8*)data++);
 			s32 x = (xy >>  0) & 0xFFFF;			if(x & 0x8000)		x |= 0xFFFF0000;
 			s32 y = (xy >> 16) & 0xFFFF;			if(y & 0x8000)		y |= 0xFFFF0000;
-			s32 z = (*(data++)) & 0xFFFF;			if(z & 0x8000)		z |= 0xFFFF0000;
+			s32 z = (get32bit_LE((u8*)data++)) & 0xFFFF;			if(z & 0x8000)		z |= 0xFFFF0000;
 
 			vtx_state[0] = ((float)x) / 4096.0f;
 			vtx_state[1] = ((float)y) / 4096.0f;
 			vtx_state[2] = ((float)z) / 4096.0f;
-			glVertex3fv(vtx_state);
-
-			update_bounds(scene, vtx_state);
+			emit_vertex(st, scene);
 		}
 		break;
 
 		//VTX_10
 		case 0x490: {
-			u32 xyz = *(data++);
+			u32 xyz = get32bit_LE((u8*)data++);
 			s32 x = (xyz >>  0) & 0x3FF;			if(x & 0x200)		x |= 0xFFFFFC00;
 			s32 y = (xyz >> 10) & 0x3FF;			if(y & 0x200)		y |= 0xFFFFFC00;
 			s32 z = (xyz >> 20) & 0x3FF;			if(z & 0x200)		z |= 0xFFFFFC00;
 			vtx_state[0] = ((float)x) / 64.0f;
 			vtx_state[1] = ((float)y) / 64.0f;
 			vtx_state[2] = ((float)z) / 64.0f;
-			glVertex3fv(vtx_state);
-
-			update_bounds(scene, vtx_state);
+			emit_vertex(st, scene);
 		}
 		break;
 
 		//VTX_XY
 		case 0x494: {
-			u32 xy = *(data++);
+			u32 xy = get32bit_LE((u8*)data++);
 			s32 x = (xy >>  0) & 0xFFFF;			if(x & 0x8000)		x |= 0xFFFF0000;
 			s32 y = (xy >> 16) & 0xFFFF;			if(y & 0x8000)		y |= 0xFFFF0000;
 			vtx_state[0] = ((float)x) / 4096.0f;
 			vtx_state[1] = ((float)y) / 4096.0f;
-			glVertex3fv(vtx_state);
-
-			update_bounds(scene, vtx_state);
+			emit_vertex(st, scene);
 		}
 		break;
 
 		//VTX_XZ
 		case 0x498: {
-			u32 xz = *(data++);
+			u32 xz = get32bit_LE((u8*)data++);
 			s32 x = (xz >>  0) & 0xFFFF;			if(x & 0x8000)		x |= 0xFFFF0000;
 			s32 z = (xz >> 16) & 0xFFFF;			if(z & 0x8000)		z |= 0xFFFF0000;
 			vtx_state[0] = ((float)x) / 4096.0f;
 			vtx_state[2] = ((float)z) / 4096.0f;
-			glVertex3fv(vtx_state);
-
-			update_bounds(scene, vtx_state);
+			emit_vertex(st, scene);
 		}
 		break;
 
 		//VTX_YZ
 		case 0x49C: {
-			u32 yz = *(data++);
+			u32 yz = get32bit_LE((u8*)data++);
 			s32 y = (yz >>  0) & 0xFFFF;			if(y & 0x8000)		y |= 0xFFFF0000;
 			s32 z = (yz >> 16) & 0xFFFF;			if(z & 0x8000)		z |= 0xFFFF0000;
 			vtx_state[1] = ((float)y) / 4096.0f;
 			vtx_state[2] = ((float)z) / 4096.0f;
-			glVertex3fv(vtx_state);
-
-			update_bounds(scene, vtx_state);
+			emit_vertex(st, scene);
 		}
 		break;
 
 		//VTX_DIFF
 		case 0x4A0: {
-			u32 xyz = *(data++);
+			u32 xyz = get32bit_LE((u8*)data++);
 			s32 x = (xyz >>  0) & 0x3FF;			if(x & 0x200)		x |= 0xFFFFFC00;
 			s32 y = (xyz >> 10) & 0x3FF;			if(y & 0x200)		y |= 0xFFFFFC00;
 			s32 z = (xyz >> 20) & 0x3FF;			if(z & 0x200)		z |= 0xFFFFFC00;
 			vtx_state[0] += ((float)x) / 4096.0f;
 			vtx_state[1] += ((float)y) / 4096.0f;
 			vtx_state[2] += ((float)z) / 4096.0f;
-			glVertex3fv(vtx_state);
-
-			update_bounds(scene, vtx_state);
+			emit_vertex(st, scene);
 		}
 		break;
 
 		//DIF_AMB
 		case 0x4C0: {
-			u32 rgb = *(data++);
+			u32 rgb = get32bit_LE((u8*)data++);
 			u32 r = (rgb >>  0) & 0x1F;
 			u32 g = (rgb >>  5) & 0x1F;
 			u32 b = (rgb >> 10) & 0x1F;
-			glColor4f(((float)r) / 31.0f, ((float)g) / 31.0f, ((float)b) / 31.0f, 0);
+			st->color[0] = ((float)r) / 31.0f;
+			st->color[1] = ((float)g) / 31.0f;
+			st->color[2] = ((float)b) / 31.0f;
+			st->color[3] = 0.0f;
+			st->flags |= VTX_HAS_COLOR;
 		}
 		break;
 
 		//BEGIN_VTXS
 		case 0x500: {
-			u32 type = *(data++);
-			switch( type )
-			{
-				case 0:		glBegin(GL_TRIANGLES);			break;
-				case 1:		glBegin(GL_QUADS);			break;
-				case 2:		glBegin(GL_TRIANGLE_STRIP);		break;
-				case 3:		glBegin(GL_QUAD_STRIP);			break;
-				default:	fatal("Bogus geom type\n");		break;
-			}
+			u32 type = get32bit_LE((u8*)data++);
+			if(type > 3)
+				fatal("Bogus geom type\n");
+			end_primitive(st);
+			begin_primitive(st, type);
 		}
 		break;
 
 		//END_VTXS
 		case 0x504: {
-			glEnd();
+			end_primitive(st);
 		}
 		break;
 
@@ -799,26 +1080,61 @@ static void do_reg(u32 reg, u32** data_pp, float vtx_state[3], float uv_state[2]
 
 */
 
-static void do_dlist(u32* data, u32 len, CModel* scene)
+static void do_dlist(u32* data, u32 len, CGeometry* geo, CModel* scene)
 {
 	u32* end = data + len / 4;
+	DlistState st;
 
-	float vtx_state[3] = { 0.0f, 0.0f, 0.0f };
-	float uv_state[2] = { 0.0f, 0.0f };
-	unsigned int mtx_id = 0;
+	memset(&st, 0, sizeof(st));
+	st.geo = geo;
+	st.max_indices = 64;
+	geo->indices = (unsigned int*) malloc(st.max_indices * sizeof(unsigned int));
+	if(!geo->indices)
+		fatal("not enough memory");
 
-	glTexCoord3f(0.0f, 0.0f, 0.0f);
 	while(data < end) {
-		u32 regs = *(data++);
+		u32 regs = get32bit_LE((u8*)data++);
 
 		u32 c;
 		for(c = 0; c < 4; c++,regs >>= 8) {
 			u32 reg = ((regs & 0xFF) << 2) + 0x400;
 
-			do_reg(reg, &data, vtx_state, uv_state, &mtx_id, scene);
+			do_reg(reg, &data, &st, scene);
+		}
+	}
+	end_primitive(&st);
+}
+
+static void clear_bounds(float bounds[3][2])
+{
+	int i;
+	for(i = 0; i < 3; i++) {
+		bounds[i][0] = FLT_MAX;
+		bounds[i][1] = -FLT_MAX;
+	}
+}
+
+static void merge_bounds(float bounds[3][2], const float other[3][2])
+{
+	int i;
+	for(i = 0; i < 3; i++) {
+		bounds[i][0] = fminf(bounds[i][0], other[i][0]);
+		bounds[i][1] = fmaxf(bounds[i][1], other[i][1]);
+	}
+}
+
+/* in the space of the dlist, i.e. before the node and weight matrices */
+static void geometry_bounds(const CGeometry* geo, float bounds[3][2])
+{
+	unsigned int i, j;
+
+	clear_bounds(bounds);
+	for(i = 0; i < geo->num_vertices; i++) {
+		for(j = 0; j < 3; j++) {
+			bounds[j][0] = fminf(bounds[j][0], geo->vertices[i].pos[j]);
+			bounds[j][1] = fmaxf(bounds[j][1], geo->vertices[i].pos[j]);
 		}
 	}
-	glTexCoord3f(0.0f, 0.0f, 0.0f);
 }
 
 static void build_meshes(CModel* scene, Mesh* meshes, Dlist* dlists, unsigned int mesh_count, void* scenedata)
@@ -827,9 +1143,16 @@ static void build_meshes(CModel* scene, Mesh* meshes, Dlist* dlists, unsigned in
 	if(!scene->meshes)
 		fatal("not enough memory");
 
+	scene->geometry = (CGeometry*) calloc(scene->num_dlists, sizeof(CGeometry));
+	if(!scene->geometry)
+		fatal("not enough memory");
+
 	unsigned int i;
 	Mesh* mesh;
 	CMesh* m;
+	MeshOptStats stats;
+
+	memset(&stats, 0, sizeof(stats));
 
 	scene->min_x = FLT_MAX;
 	scene->min_y = FLT_MAX;
@@ -839,17 +1162,205 @@ static void build_meshes(CModel* scene, Mesh* meshes, Dlist* dlists, unsigned in
 	scene->max_z = -FLT_MAX;
 
 	for(i = 0, mesh = meshes, m = scene->meshes; i < mesh_count; mesh++, m++, i++) {
-		Dlist* dlist = &dlists[mesh->dlistid];
-		u32* data = (u32*) (scenedata + dlist->start_ofs);
-		m->matid = mesh->matid;
-		m->dlistid = mesh->dlistid;
-		if(scene->dlists[m->dlistid] != -1)
+		m->matid = get16bit_LE((u8*)&mesh->matid);
+		m->dlistid = get16bit_LE((u8*)&mesh->dlistid);
+		if(scene->geometry[m->dlistid].indices)
 			continue;
-		scene->dlists[m->dlistid] = glGenLists(1);
-		glNewList(scene->dlists[m->dlistid], GL_COMPILE);
-		do_dlist(data, dlist->size, scene);
-		glEndList();
+		Dlist* dlist = &dlists[m->dlistid];
+		u32* data = (u32*) (scenedata + get32bit_LE((u8*)&dlist->start_ofs));
+		do_dlist(data, get32bit_LE((u8*)&dlist->size), &scene->geometry[m->dlistid], scene);
+		optimize_geometry(&scene->geometry[m->dlistid], &stats);
+	}
+
+	for(i = 0, m = scene->meshes; i < mesh_count; m++, i++)
+		geometry_bounds(&scene->geometry[m->dlistid], m->bounds);
+
+	printf("meshopt: %u -> %u vertices, %u -> %u triangles\n",
+			stats.vertices_in, stats.vertices_out, stats.triangles_in, stats.triangles_out);
+}
+
+/*
+
+	GPU vertex layout, 20 bytes instead of the 56 of CVertex
+
+	Everything is kept in the precision the GX commands deliver it in:
+		position	s16 x, y, z in 4.12 (shifted right by pos_shift if the
+				model does not fit), s16 matrix id
+		texcoord	s16 s, t in 12.4
+		normal		10 bit signed x, y, z as GL_INT_2_10_10_10_REV
+		color		5 bit r, g, b as bytes, a = 0 (DIF_AMB), 1 (COLOR) or 2 (none)
+
+	Without GL 3.3 or ARB_vertex_type_2_10_10_10_rev the normal is stored
+	as s16 x, y, z instead, 24 bytes per vertex. The vertex shader applies
+	the scale factors and normalizes the normal either way.
+
+*/
+typedef struct {
+	s16	pos[4];
+	s16	uv[2];
+	u32	normal;
+	u8	color[4];
+} GLVertex;
+
+typedef struct {
+	s16	pos[4];
+	s16	uv[2];
+	s16	normal[4];
+	u8	color[4];
+} GLVertexShortNormal;
+
+/* looked up on first use, models may be uploaded before CModel_init */
+static bool packed_normals(void)
+{
+	static int supported = -1;
+
+	if(supported < 0) {
+		const char* version = (const char*) glGetString(GL_VERSION);
+		const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+		int major = 0, minor = 0;
+		if(version)
+			sscanf(version, "%d.%d", &major, &minor);
+		supported = major > 3 || (major == 3 && minor >= 3) || (extensions && strstr(extensions, "GL_ARB_vertex_type_2_10_10_10_rev"));
+		if(!supported)
+			printf("no GL_INT_2_10_10_10_REV vertices, normals are uploaded as shorts\n");
+	}
+	return supported;
+}
+
+/* sign extends the 10 bit components */
+static void unpack_vertex(GLVertexShortNormal* out, const GLVertex* v)
+{
+	int i;
+
+	memcpy(out->pos, v->pos, sizeof(out->pos));
+	memcpy(out->uv, v->uv, sizeof(out->uv));
+	for(i = 0; i < 3; i++)
+		out->normal[i] = (s16) ((s32) (v->normal << (22 - i * 10)) >> 22);
+	out->normal[3] = 0;
+	memcpy(out->color, v->color, sizeof(out->color));
+}
+
+static s32 quantize(float value, float scale, s32 min, s32 max)
+{
+	s32 v = (s32) lrintf(value * scale);
+	return v < min ? min : v > max ? max : v;
+}
+
+static void pack_vertex(GLVertex* out, const CVertex* v, int pos_shift)
+{
+	float pos_scale = 4096.0f / (1 << pos_shift);
+	int i;
+
+	for(i = 0; i < 3; i++)
+		out->pos[i] = (s16) quantize(v->pos[i], pos_scale, -32768, 32767);
+	out->pos[3] = (s16) v->uv[2];
+	out->uv[0] = (s16) quantize(v->uv[0], 16.0f, -32768, 32767);
+	out->uv[1] = (s16) quantize(v->uv[1], 16.0f, -32768, 32767);
+
+	out->normal = 0;
+	for(i = 0; i < 3; i++)
+		out->normal |= (quantize(v->normal[i], 512.0f, -512, 511) & 0x3FF) << (i * 10);
+
+	for(i = 0; i < 3; i++)
+		out->color[i] = (u8) quantize(v->color[i], 31.0f, 0, 31);
+	out->color[3] = v->color[3] < 0.0f ? 2 : v->color[3] > 0.5f ? 1 : 0;
+}
+
+/* smallest shift that makes all positions fit into s16 */
+static int position_shift(CModel* scene)
+{
+	unsigned int i, j, k;
+	float max = 0.0f;
+	int shift = 0;
+
+	for(i = 0; i < scene->num_dlists; i++) {
+		CGeometry* geo = &scene->geometry[i];
+		for(j = 0; j < geo->num_vertices; j++) {
+			for(k = 0; k < 3; k++)
+				max = fmaxf(max, fabsf(geo->vertices[j].pos[k]));
+		}
+	}
+
+	while(max * 4096.0f / (1 << shift) > 32767.0f)
+		shift++;
+	return shift;
+}
+
+/* one vertex and one index buffer per model, each dlist becomes a range of the index buffer */
+static void upload_meshes(CModel* scene)
+{
+	unsigned int i, j;
+	unsigned int num_vertices = 0;
+	unsigned int num_indices = 0;
+	unsigned int* indices;
+	GLVertex* vertices;
+
+	for(i = 0; i < scene->num_dlists; i++) {
+		num_vertices += scene->geometry[i].num_vertices;
+		num_indices += scene->geometry[i].num_indices;
+	}
+
+	scene->dlists = (CDrawRange*) calloc(scene->num_dlists, sizeof(CDrawRange));
+	indices = (unsigned int*) malloc(num_indices * sizeof(unsigned int) + 1);
+	vertices = (GLVertex*) malloc(num_vertices * sizeof(GLVertex) + 1);
+	if(!scene->dlists || !indices || !vertices)
+		fatal("not enough memory");
+
+	scene->pos_shift = position_shift(scene);
+
+	num_vertices = 0;
+	num_indices = 0;
+	for(i = 0; i < scene->num_dlists; i++) {
+		CGeometry* geo = &scene->geometry[i];
+		CDrawRange* range = &scene->dlists[i];
+
+		for(j = 0; j < geo->num_vertices; j++)
+			pack_vertex(&vertices[num_vertices + j], &geo->vertices[j], scene->pos_shift);
+
+		range->first = num_indices;
+		range->count = geo->num_indices;
+		for(j = 0; j < geo->num_indices; j++)
+			indices[num_indices++] = geo->indices[j] + num_vertices;
+		num_vertices += geo->num_vertices;
+	}
+
+	glGenBuffers(1, &scene->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, scene->vbo);
+	if(packed_normals()) {
+		glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(GLVertex), vertices, GL_STATIC_DRAW);
+	} else {
+		GLVertexShortNormal* wide = (GLVertexShortNormal*) malloc(num_vertices * sizeof(GLVertexShortNormal) + 1);
+		if(!wide)
+			fatal("not enough memory");
+		for(j = 0; j < num_vertices; j++)
+			unpack_vertex(&wide[j], &vertices[j]);
+		glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(GLVertexShortNormal), wide, GL_STATIC_DRAW);
+		free(wide);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &scene->ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	free(vertices);
+	free(indices);
+}
+
+static void free_geometry(CModel* scene)
+{
+	unsigned int i;
+
+	if(!scene->geometry)
+		return;
+
+	for(i = 0; i < scene->num_dlists; i++) {
+		model_free(scene, scene->geometry[i].vertices);
+		model_free(scene, scene->geometry[i].indices);
 	}
+	model_free(scene, scene->geometry);
+	scene->geometry = NULL;
 }
 
 /*
@@ -867,301 +1378,328 @@ static void build_meshes(CModel* scene, Mesh* meshes, Dlist* dlists, unsigned in
 	Palette entries are 16bit RGBA
 
 */
-static void make_textures(CModel* model)
+/* the cache key of a material's texture, with the wrap and filter overrides
+   applied to the material; FALSE if it has no usable texture */
+static bool material_key(CModel* model, u32 m, TexCacheKey* key)
 {
-	u32 m;
-	for(m = 0; m < model->num_materials; m++) {
-		CMaterial* mat = &model->materials[m];
-		if(mat->texid == 0xFFFF)
-			continue;
-		if(mat->texid >= model->num_textures) {
-			printf("invalid texture id %04X for material %d\n", mat->texid, m);
-			continue;
-		}
+	CMaterial* mat = &model->materials[m];
+	CTexture* tex;
+	u32 texsize, palsize = 0;
+	u32 n;
 
-		if(mat->palid != 0xFFFF && !model->palettes)
-			fatal("missing palette");
+	memset(key, 0, sizeof(TexCacheKey));
 
-		CTexture* tex = &model->textures[mat->texid];
+	if(mat->texid >= model->num_textures) {
+		printf("invalid texture id %04X for material %d\n", mat->texid, m);
+		return false;
+	}
+
+	if(mat->palid != 0xFFFF && !model->palettes)
+		fatal("missing palette");
+
+	tex = &model->textures[mat->texid];
+	texsize = tex->width * tex->height;
+	switch(tex->format) {
+		case 0:
+			texsize /= 4;
+			palsize = 8;
+			break;
+		case 1:
+			texsize /= 2;
+			palsize = 32;
+			break;
+		case 2:
+			palsize = 512;
+			break;
+		case 4:
+			palsize = 16;
+			break;
+		case 5:
+			texsize *= 2;
+			break;
+		case 6:
+			palsize = 64;
+	}
+
+	key->texel_hash = tex->data ? crc32(tex->data, texsize) : 0;
+	/* only the entries the format can reach; direct colour has no palette */
+	if(palsize && mat->palid != 0xFFFF) {
 		CPalette* pal = &model->palettes[mat->palid];
+		if(pal->data)
+			key->palette_hash = crc32((u8*) pal->data, pal->size < palsize ? pal->size : palsize);
+	}
+	key->format = tex->format;
+	key->width = tex->width;
+	key->height = tex->height;
+	key->opaque = tex->opaque;
+	key->alpha = mat->alpha;
+	key->polygon_mode = mat->polygon_mode;
+
+	mat->wrap_s = mat->x_repeat;
+	mat->wrap_t = mat->y_repeat;
+	mat->filter = 1;
+	if(mat->x_repeat > MIRROR)
+		printf("unknown repeat mode %d\n", mat->x_repeat);
+	if(mat->y_repeat > MIRROR)
+		printf("unknown repeat mode %d\n", mat->y_repeat);
+
+	for(n = 0; n < NUM_OVERRIDES; n++) {
+		TEXOVERRIDE* ovr = &mtl_overrides[n];
+		if(ovr->checksum == key->texel_hash) {
+			if(ovr->x_repeat >= 0)
+				mat->wrap_s = ovr->x_repeat;
+			if(ovr->y_repeat >= 0)
+				mat->wrap_t = ovr->y_repeat;
+			if(ovr->filter >= 0)
+				mat->filter = ovr->filter;
+		}
+	}
 
-		u8* texels = tex->data;
-		u16* paxels = pal->data;
+	key->wrap_s = mat->wrap_s;
+	key->wrap_t = mat->wrap_t;
+	key->filter = mat->filter;
 
-		u32 num_pixels = (u32)tex->width * (u32)tex->height;
+	/* the key of an indexed material is that of its palette texture */
+	mat->indexed = indexed_textures && palsize;
+	key->type = mat->indexed ? TEXCACHE_PALETTE : TEXCACHE_RGBA;
+	return true;
+}
 
-		u32* image = (u32*) malloc(sizeof(u32) * num_pixels);
-		if(!image)
-			fatal("not enough memory");
+/* the key of the index texture, which only depends on the texels */
+static void index_key(const TexCacheKey* key, TexCacheKey* out)
+{
+	memset(out, 0, sizeof(TexCacheKey));
+	out->texel_hash = key->texel_hash;
+	out->format = key->format;
+	out->width = key->width;
+	out->height = key->height;
+	out->wrap_s = key->wrap_s;
+	out->wrap_t = key->wrap_t;
+	out->type = TEXCACHE_INDICES;
+}
 
-		float alpha = mat->alpha / 31.0;
-
-		if(tex->format == 0) {				// 2bit palettised
-			u32 p;
-			for(p = 0; p < num_pixels; p++) {
-				u32 index = texels[p / 4];
-				index = (index >> ((p % 4) * 2)) & 0x3;
-				u16 col = get16bit_LE((u8*)&paxels[index]);
-				u32 r = ((col >>  0) & 0x1F) << 3;
-				u32 g = ((col >>  5) & 0x1F) << 3;
-				u32 b = ((col >> 10) & 0x1F) << 3;
-				u32 a = (tex->opaque ? 0xFF : (index == 0 ? 0x00 : 0xFF)) * alpha;
-				image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-			}
-		} else if(tex->format == 1) {			// 4bit palettised
-			u32 p;
-			for(p = 0; p < num_pixels; p++) {
-				u32 index = texels[p / 2];
-				index = (index >> ((p % 2) * 4)) & 0xF;
-				u16 col = get16bit_LE((u8*)&paxels[index]);
-				u32 r = ((col >>  0) & 0x1F) << 3;
-				u32 g = ((col >>  5) & 0x1F) << 3;
-				u32 b = ((col >> 10) & 0x1F) << 3;
-				u32 a = (tex->opaque ? 0xFF : (index == 0 ? 0x00 : 0xFF)) * alpha;
-				image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-			}
-		} else if(tex->format == 2) {			// 8bit palettised
-			u32 p;
-			for(p = 0; p < num_pixels; p++) {
-				u32 index = texels[p];
-				u16 col = get16bit_LE((u8*)&paxels[index]);
-				u32 r = ((col >>  0) & 0x1F) << 3;
-				u32 g = ((col >>  5) & 0x1F) << 3;
-				u32 b = ((col >> 10) & 0x1F) << 3;
-				u32 a = (tex->opaque ? 0xFF : (index == 0 ? 0x00 : 0xFF)) * alpha;
-				image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-			}
-		} else if(tex->format == 4) {			// A5I3
-			u32 p;
-			for(p = 0; p < num_pixels; p++) {
-				u8 entry = texels[p];
-				u8 i = (entry & 0x07);
-				u16 col = get16bit_LE((u8*)&paxels[i]);
-				u32 r = ((col >>  0) & 0x1F) << 3;
-				u32 g = ((col >>  5) & 0x1F) << 3;
-				u32 b = ((col >> 10) & 0x1F) << 3;
-				u32 a = (tex->opaque ? 0xFF : ((entry >> 3) / 31.0 * 255.0)) * alpha;
-				image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-			}
-		} else if(tex->format == 5) {			// 16it RGB
-			u32 p;
-			for(p = 0; p < num_pixels; p++) {
-				u16 col = (u16)texels[p * 2 + 0] | (((u16)texels[p * 2 + 1]) << 8);
-				u32 r = ((col >> 0) & 0x1F) << 3;
-				u32 g = ((col >> 5) & 0x1F) << 3;
-				u32 b = ((col >> 10) & 0x1F) << 3;
-				u32 a = (tex->opaque ? 0xFF : ((col & 0x8000) ? 0xFF : 0x00)) * alpha;
-				image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-			}
-		} else if(tex->format == 6) {			// A3I5
-			u32 p;
-			for(p = 0; p < num_pixels; p++) {
-				u8 entry = texels[p];
-				u32 i = entry & 0x1F;
-				u16 col = get16bit_LE((u8*)&paxels[i]);
-				u32 r = ((col >>  0) & 0x1F) << 3;
-				u32 g = ((col >>  5) & 0x1F) << 3;
-				u32 b = ((col >> 10) & 0x1F) << 3;
-				u32 a = (tex->opaque ? 0xFF : ((entry >> 5) / 7.0 * 255.0)) * alpha;
-				image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-			}
-		} else {
-			BREAKPOINT();
-			print_once("Unhandled texture-format: %d\n", tex->format);
-			memset(image, 0x7F, num_pixels * 4);
-		}
+/* copies of another model's materials share its references and drop them
+   without a release */
+static void release_entries(CMaterial* mat)
+{
+	if(mat->entry_owner == mat) {
+		if(mat->tex_entry)
+			TEXCacheRelease(mat->tex_entry);
+		if(mat->palette_entry)
+			TEXCacheRelease(mat->palette_entry);
+	}
+	mat->tex_entry = NULL;
+	mat->palette_entry = NULL;
+	mat->entry_owner = NULL;
+}
 
-		u32 p;
-		switch(mat->polygon_mode) {
-			case GX_POLYGONMODE_MODULATE:
-				break;
-			case GX_POLYGONMODE_DECAL:
-				for(p = 0; p < num_pixels; p++) {
-					u32 col = image[p];
-					u32 r = (col >>  0) & 0xFF;
-					u32 g = (col >>  8) & 0xFF;
-					u32 b = (col >> 16) & 0xFF;
-					u32 a = 0xFF * alpha;
-					image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
-				}
-				break;
-			case GX_POLYGONMODE_TOON:
-				break;
-			case GX_POLYGONMODE_SHADOW:
-				break;
-			default:
-				printf("unknown alpha mode %d\n", mat->alpha);
-				break;
-		}
+/* references the cached textures of a material it does not hold yet,
+   TRUE if it has all it needs */
+static bool find_cached(CMaterial* mat)
+{
+	mat->entry_owner = mat;
+	if(!mat->tex_entry) {
+		TexCacheKey key;
+		if(mat->indexed)
+			index_key(&mat->tex_key, &key);
+		else
+			key = mat->tex_key;
+		mat->tex_entry = TEXCacheFind(&key);
+	}
+	if(mat->indexed && !mat->palette_entry)
+		mat->palette_entry = TEXCacheFind(&mat->tex_key);
+	return mat->tex_entry && (!mat->indexed || mat->palette_entry);
+}
 
-		int translucent = 0;
-		for(p = 0; p < num_pixels; p++) {
-			u32 col = image[p];
-			u32 a = (col >> 24) & 0xFF;
-			if(a != 0xFF) {
-				translucent = 1;
-				break;
-			}
-		}
-		if(mat->alpha < 31) {
-			mat->render_mode = TRANSLUCENT;
-			translucent = 1;
+static void set_render_mode(CModel* model, u32 m, bool translucent)
+{
+	CMaterial* mat = &model->materials[m];
+	CTexture* tex = &model->textures[mat->texid];
+
+	if(mat->alpha < 31) {
+		mat->render_mode = TRANSLUCENT;
+		translucent = true;
+	}
+	if(mat->render_mode != NORMAL) {
+		if(!translucent) {
+			printf("%d [%s]: strange, this should be opaque (alpha: %d, fmt: %d, opaque: %d)\n", m, mat->name, mat->alpha, tex->format, tex->opaque);
+			mat->render_mode = NORMAL;
 		}
-		if(mat->render_mode != NORMAL) {
-			if(!translucent) {
-				printf("%d [%s]: strange, this should be opaque (alpha: %d, fmt: %d, opaque: %d)\n", m, mat->name, mat->alpha, tex->format, tex->opaque);
-				mat->render_mode = NORMAL;
-			}
-		} else if(translucent) {
-			// there are translucent pixels, but the material is not marked as translucent
-			printf("%d [%s]: strange, this should be translucent (alpha: %d, fmt: %d, opaque: %d)\n", m, mat->name, mat->alpha, tex->format, tex->opaque);
-			mat->render_mode = TRANSLUCENT;
+	} else if(translucent) {
+		// there are translucent pixels, but the material is not marked as translucent
+		printf("%d [%s]: strange, this should be translucent (alpha: %d, fmt: %d, opaque: %d)\n", m, mat->name, mat->alpha, tex->format, tex->opaque);
+		mat->render_mode = TRANSLUCENT;
+	}
+}
+
+/* decodes the image of a material whose key is set */
+static void decode_material(CModel* model, u32 m)
+{
+	CMaterial* mat = &model->materials[m];
+	CTexture* tex = &model->textures[mat->texid];
+	CPalette* pal = mat->palid != 0xFFFF ? &model->palettes[mat->palid] : NULL;
+	u32 num_pixels = (u32)tex->width * (u32)tex->height;
+	bool decal = mat->polygon_mode == GX_POLYGONMODE_DECAL;
+	bool translucent = false;
+
+	u32* image = (u32*) malloc(MATERIAL_IMAGE_SIZE(mat, tex));
+	if(!image)
+		fatal("not enough memory");
+
+	if(mat->indexed) {
+		/* material_key only picks palettised formats for this */
+		if(!TEXDecodeIndexed((u8*) (image + 256), image, tex, pal, mat->alpha, decal, &translucent)) {
+			memset(image, 0x7F, MATERIAL_IMAGE_SIZE(mat, tex));
+			translucent = true;
 		}
+	} else if(!TEXDecode(image, tex, pal, mat->alpha, decal, &translucent)) {
+		BREAKPOINT();
+		print_once("Unhandled texture-format: %d\n", tex->format);
+		memset(image, 0x7F, num_pixels * 4);
+		translucent = true;
+	}
 
-		glGenTextures(1, &mat->tex);
-		glBindTexture(GL_TEXTURE_2D, mat->tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex->width, tex->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)image);
-#if 0
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-#else
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	if(mat->polygon_mode > GX_POLYGONMODE_SHADOW)
+		printf("unknown alpha mode %d\n", mat->alpha);
+
+	set_render_mode(model, m, translucent);
+	mat->translucent = translucent;
+
+#ifdef TEXDUMP
+	if(mat->indexed) {
+		mat->image = image;
+		return;
+	}
+	char filename[128];
+	if(mat->name[0] == 0) {
+		sprintf(filename, "texdump/%dx%d-%08x-%08x.bmp", tex->width, tex->height, mat->tex_key.texel_hash, mat->tex_key.palette_hash);
+	} else {
+		sprintf(filename, "texdump/%dx%d-%08x-%08x-%s.bmp", tex->width, tex->height, mat->tex_key.texel_hash, mat->tex_key.palette_hash, mat->name);
+	}
+	FILE* f = fopen(filename, "wb");
+	BMP bmp;
+	bmp.bfType = 0x4D42;
+	bmp.bfSize = sizeof(BMP) + tex->width * tex->height * 4;
+	bmp.bfReserved = 0;
+	bmp.bfOffBits = sizeof(BMP);
+	bmp.biSize = 40;
+	bmp.biWidth = tex->width;
+	bmp.biHeight = tex->height;
+	bmp.biPlanes = 1;
+	bmp.biBitCount = 32;
+	bmp.biCompression = 0;
+	bmp.biSizeImage = 0;
+	bmp.biXPelsPerMeter = 0;
+	bmp.biYPelsPerMeter = 0;
+	bmp.biClrUsed = 0;
+	bmp.biClrImportant = 0;
+	fwrite(&bmp, sizeof(BMP), 1, f);
+	for(u32 n = 0; n < (tex->width * tex->height); n++) {
+		u32 px = image[n];
+		u32 r = (px >>  0) & 0xFF;
+		u32 g = (px >>  8) & 0xFF;
+		u32 b = (px >> 16) & 0xFF;
+		u32 a = (px >> 24) & 0xFF;
+		px = b | (g << 8) | (r << 16) | (a << 24);
+		fwrite(&px, 4, 1, f);
+	}
+	fclose(f);
 #endif
-		switch(mat->x_repeat) {
-			case CLAMP:
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				break;
-			case REPEAT:
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-				break;
-			case MIRROR:
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-				break;
-			default:
-				printf("unknown repeat mode %d\n", mat->x_repeat);
-		}
-		switch(mat->y_repeat) {
-			case CLAMP:
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-				break;
-			case REPEAT:
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-				break;
-			case MIRROR:
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-				break;
-			default:
-				printf("unknown repeat mode %d\n", mat->x_repeat);
-		}
 
-		u32 texsize = num_pixels;
-		u32 palsize = 0;
-		switch(tex->format) {
-			case 0:
-				texsize /= 4;
-				palsize = 8;
-				break;
-			case 1:
-				texsize /= 2;
-				palsize = 32;
-				break;
-			case 2:
-				palsize = 512;
-				break;
-			case 4:
-				palsize = 16;
-				break;
-			case 5:
-				texsize *= 2;
-				break;
-			case 6:
-				palsize = 64;
-		}
+	mat->image = image;
+}
+
+/* material images that are not in the texture cache yet */
+static void decode_textures(CModel* model)
+{
+	u32 m;
+	for(m = 0; m < model->num_materials; m++) {
+		CMaterial* mat = &model->materials[m];
+		if(mat->texid == 0xFFFF)
+			continue;
+		model_free(model, mat->image);
+		mat->image = NULL;
+		release_entries(mat);
+
+		if(!material_key(model, m, &mat->tex_key))
+			continue;
 
-		u32 hash = crc32(texels, texsize);
-		u32 palhash = crc32((u8*) paxels, pal->size);
+		if(find_cached(mat))
+			set_render_mode(model, m, (mat->indexed ? mat->palette_entry : mat->tex_entry)->translucent);
+		else
+			decode_material(model, m);
+	}
+}
 
-#ifdef TEXDUMP
-		char filename[128];
-		if(mat->name[0] == 0) {
-			sprintf(filename, "texdump/%dx%d-%08x-%08x.bmp", tex->width, tex->height, hash, palhash);
-		} else {
-			sprintf(filename, "texdump/%dx%d-%08x-%08x-%s.bmp", tex->width, tex->height, hash, palhash, mat->name);
-		}
-		FILE* f = fopen(filename, "wb");
-		BMP bmp;
-		bmp.bfType = 0x4D42;
-		bmp.bfSize = sizeof(BMP) + tex->width * tex->height * 4;
-		bmp.bfReserved = 0;
-		bmp.bfOffBits = sizeof(BMP);
-		bmp.biSize = 40;
-		bmp.biWidth = tex->width;
-		bmp.biHeight = tex->height;
-		bmp.biPlanes = 1;
-		bmp.biBitCount = 32;
-		bmp.biCompression = 0;
-		bmp.biSizeImage = 0;
-		bmp.biXPelsPerMeter = 0;
-		bmp.biYPelsPerMeter = 0;
-		bmp.biClrUsed = 0;
-		bmp.biClrImportant = 0;
-		fwrite(&bmp, sizeof(BMP), 1, f);
-		for(u32 n = 0; n < (tex->width * tex->height); n++) {
-			u32 px = image[n];
-			u32 r = (px >>  0) & 0xFF;
-			u32 g = (px >>  8) & 0xFF;
-			u32 b = (px >> 16) & 0xFF;
-			u32 a = (px >> 24) & 0xFF;
-			px = b | (g << 8) | (r << 16) | (a << 24);
-			fwrite(&px, 4, 1, f);
-		}
-		fclose(f);
-#endif
+static GLint gl_wrap_mode(int repeat)
+{
+	switch(repeat) {
+		case CLAMP:
+			return GL_CLAMP_TO_EDGE;
+		case MIRROR:
+			return GL_MIRRORED_REPEAT;
+		case REPEAT:
+		default:
+			return GL_REPEAT;
+	}
+}
 
-		for(u32 n = 0; n < NUM_OVERRIDES; n++) {
-			TEXOVERRIDE* ovr = &mtl_overrides[n];
-			if(ovr->checksum == hash) {
-				if(ovr->x_repeat >= 0) {
-					switch(ovr->x_repeat) {
-						case CLAMP:
-							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-							break;
-						case REPEAT:
-							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-							break;
-						case MIRROR:
-							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-							break;
-						default:
-							printf("unknown repeat mode %d\n", ovr->x_repeat);
-					}
-				}
-				if(ovr->y_repeat >= 0) {
-					switch(ovr->y_repeat) {
-						case CLAMP:
-							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-							break;
-						case REPEAT:
-							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-							break;
-						case MIRROR:
-							glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-							break;
-						default:
-							printf("unknown repeat mode %d\n", ovr->y_repeat);
-					}
-				}
-				if(ovr->filter >= 0) {
-					int type = ovr->filter ? GL_LINEAR : GL_NEAREST;
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, type);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, type);
-				}
+static void upload_textures(CModel* model)
+{
+	u32 m;
+	for(m = 0; m < model->num_materials; m++) {
+		CMaterial* mat = &model->materials[m];
+		if(mat->texid == 0xFFFF || mat->texid >= model->num_textures)
+			continue;
+
+		/* decoded by another model since, or baked while it was cached */
+		if(!find_cached(mat) && !mat->image)
+			decode_material(model, m);
+
+		CTexture* tex = &model->textures[mat->texid];
+
+		mat->entry_owner = mat;
+		if(!mat->tex_entry) {
+			/* indices are filtered in the shader, after the lookup */
+			int filter = mat->filter && !mat->indexed ? GL_LINEAR : GL_NEAREST;
+
+			glGenTextures(1, &mat->tex);
+			glBindTexture(GL_TEXTURE_2D, mat->tex);
+			if(mat->indexed) {
+				TexCacheKey key;
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, tex->width, tex->height, 0, GL_RED, GL_UNSIGNED_BYTE, (GLvoid*)(mat->image + 256));
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				index_key(&mat->tex_key, &key);
+				mat->tex_entry = TEXCacheAdd(&key, mat->tex, false);
+			} else {
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex->width, tex->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)mat->image);
+				mat->tex_entry = TEXCacheAdd(&mat->tex_key, mat->tex, mat->translucent);
 			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, gl_wrap_mode(mat->wrap_s));
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, gl_wrap_mode(mat->wrap_t));
+			glBindTexture(GL_TEXTURE_2D, 0);
 		}
+		mat->tex = mat->tex_entry->tex;
+
+		if(mat->indexed && !mat->palette_entry) {
+			glGenTextures(1, &mat->palette_tex);
+			glBindTexture(GL_TEXTURE_2D, mat->palette_tex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)mat->image);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			mat->palette_entry = TEXCacheAdd(&mat->tex_key, mat->palette_tex, mat->translucent);
+		}
+		if(mat->indexed)
+			mat->palette_tex = mat->palette_entry->tex;
 
-		glBindTexture(GL_TEXTURE_2D, 0);
-		free(image);
+		model_free(model, mat->image);
+		mat->image = NULL;
 	}
 }
 
@@ -1237,54 +1775,96 @@ void CModel_filter_nodes(CModel* scene, int layer_mask)
 	}
 }
 
-void load_model(CModel** model, const char* filename, int flags)
+void parse_model(CModel** model, const char* filename, int flags)
 {
+	FileStamp stamp;
 	u8* data = NULL;
 	int size = 0;
 
 	printf("loading model %s\n", filename);
+	if(flags & USE_ARCHIVE)
+		StampFileInArchive(&stamp, filename);
+	else
+		StampFile(&stamp, filename);
+
+	*model = CModel_find_baked(filename, &stamp, &stamp, 0xFFFFFFFF);
+	if(*model)
+		return;
+
 	if(flags & USE_ARCHIVE) {
-		size = LoadFileFromArchive((void**)&data, filename);
+		size = BorrowFileFromArchive((void**)&data, filename);
 	} else {
-		size = LoadFile((void**)&data, filename);
+		size = MapFile((void**)&data, filename, FS_MAP_READ);
 	}
 
-	*model = CModel_load(data, size, data, size, 0xFFFFFFFF);
+	*model = CModel_parse(data, size, data, size, 0xFFFFFFFF);
+	CModel_store_baked(filename, &stamp, &stamp, 0xFFFFFFFF, *model);
 
-	free_to_heap(data);
+	if(!(flags & USE_ARCHIVE))
+		UnmapFile(data, size);
 }
 
-void load_room_model(CModel** model, const char* filename, const char* txtrfilename, int flags, int layer_mask)
+void parse_room_model(CModel** model, const char* filename, const char* txtrfilename, int flags, int layer_mask)
 {
+	FileStamp stamp;
+	FileStamp txtrstamp;
 	u8* data = NULL;
 	int size = 0;
 	u8* txtr = NULL;
 	int txtrsz = 0;
 
 	printf("loading model %s\n", filename);
+	if(flags & USE_ARCHIVE)
+		StampFileInArchive(&stamp, filename);
+	else
+		StampFile(&stamp, filename);
+	if(flags & USE_EXTERNAL_TXTR)
+		StampFile(&txtrstamp, txtrfilename);
+	else
+		txtrstamp = stamp;
+
+	*model = CModel_find_baked(filename, &stamp, &txtrstamp, layer_mask);
+	if(*model)
+		return;
+
 	if(flags & USE_ARCHIVE) {
-		size = LoadFileFromArchive((void**)&data, filename);
+		size = BorrowFileFromArchive((void**)&data, filename);
 	} else {
-		size = LoadFile((void**)&data, filename);
+		size = MapFile((void**)&data, filename, FS_MAP_READ);
 	}
 
 	if(flags & USE_EXTERNAL_TXTR) {
-		txtrsz = LoadFile((void**)&txtr, txtrfilename);
+		txtrsz = MapFile((void**)&txtr, txtrfilename, FS_MAP_READ);
 	} else {
 		txtr = data;
 		txtrsz = size;
 	}
 
-	*model = CModel_load(data, size, txtr, txtrsz, layer_mask);
+	*model = CModel_parse(data, size, txtr, txtrsz, layer_mask);
+	CModel_store_baked(filename, &stamp, &txtrstamp, layer_mask, *model);
 
 	if(flags & USE_EXTERNAL_TXTR) {
-		free_to_heap(txtr);
+		UnmapFile(txtr, txtrsz);
 	}
 
-	free_to_heap(data);
+	if(!(flags & USE_ARCHIVE))
+		UnmapFile(data, size);
 }
 
-CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsigned int texturesize, int layer_mask)
+void load_model(CModel** model, const char* filename, int flags)
+{
+	parse_model(model, filename, flags);
+	CModel_upload(*model);
+}
+
+void load_room_model(CModel** model, const char* filename, const char* txtrfilename, int flags, int layer_mask)
+{
+	parse_room_model(model, filename, txtrfilename, flags, layer_mask);
+	CModel_upload(*model);
+}
+
+/* everything up to the GL objects, safe to call from any thread */
+CModel* CModel_parse(u8* scenedata, unsigned int scenesize, u8* texturedata, unsigned int texturesize, int layer_mask)
 {
 	unsigned int i, j;
 
@@ -1296,6 +1876,13 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 	scene->node_animation = NULL;
 	scene->texcoord_animations = NULL;
 	scene->material_animations = NULL;
+	scene->scenedata = NULL;
+	scene->baked = NULL;
+	scene->baked_size = 0;
+	scene->meshes = NULL;
+	scene->geometry = NULL;
+	scene->num_dlists = 0;
+	scene->node_weight_ids = NULL;
 
 	HEADER* rawheader = (HEADER*) scenedata;
 
@@ -1388,7 +1975,7 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 		int* ids = (int*)((uintptr_t)scenedata + (uintptr_t)get32bit_LE((u8*)&rawheader->node_weights));
 		scene->node_weight_ids = (int*)malloc(scene->num_node_weight * sizeof(int));
 		for (int i = 0; i < scene->num_node_weight; i++) {
-			scene->node_weight_ids[i] = ids[i];
+			scene->node_weight_ids[i] = get32bit_LE((u8*)&ids[i]);
 		}
 	}
 
@@ -1401,15 +1988,12 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 	if(rawheader->materials) {
 		for(i = 0; i < scene->num_materials; i++) {
 			Material* m = &materials[i];
-			m->palid = get16bit_LE((u8*)&m->palid);
-			m->texid = get16bit_LE((u8*)&m->texid);
 
 			CMaterial* mat = &scene->materials[i];
 			strcpy(mat->name, m->name);
 			mat->render_mode = m->render_mode;
 			//if(mat->render_mode > 2)
 			//	mat->render_mode = TRANSLUCENT;
-			mat->texid = m->texid;
 			mat->light = m->light;
 			mat->culling = m->culling;
 			mat->alpha = m->alpha;
@@ -1437,8 +2021,18 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 
 			mat->texgen_mode = get32bit_LE((u8*)&m->texcoord_transform_mode);
 			mat->matrix_id = get32bit_LE((u8*)&m->matrix_id);
-			mat->palid = m->palid;
-			mat->texid = m->texid;
+			mat->palid = get16bit_LE((u8*)&m->palid);
+			mat->texid = get16bit_LE((u8*)&m->texid);
+			mat->tex = 0;
+			mat->palette_tex = 0;
+			mat->indexed = false;
+			mat->tex_entry = NULL;
+			mat->palette_entry = NULL;
+			mat->entry_owner = NULL;
+			mat->image = NULL;
+			mat->wrap_s = mat->x_repeat;
+			mat->wrap_t = mat->y_repeat;
+			mat->filter = 1;
 			printf("material %d: render mode is %d\n", i, mat->render_mode);
 		}
 	}
@@ -1453,6 +2047,7 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 			CPalette* pal = &scene->palettes[i];
 			u32 entries_ofs = get32bit_LE((u8*)&palettes[i].entries_ofs);
 			pal->size = get32bit_LE((u8*)&palettes[i].count);
+			pal->data = NULL;
 			if(entries_ofs >= texturesize) {
 				printf("invalid paxel offset for palette %d\n", i, entries_ofs);
 				continue;
@@ -1470,58 +2065,45 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 		for(i = 0; i < scene->num_textures; i++) {
 			CTexture* tex = &scene->textures[i];
 			Texture* t = &textures[i];
-			t->width = get16bit_LE((u8*)&t->width);
-			t->height = get16bit_LE((u8*)&t->height);
-			t->image_ofs = get32bit_LE((u8*)&t->image_ofs);
-			t->imagesize = get32bit_LE((u8*)&t->imagesize);
+			u32 image_ofs = get32bit_LE((u8*)&t->image_ofs);
+			u32 imagesize = get32bit_LE((u8*)&t->imagesize);
 			tex->format = get16bit_LE((u8*)&t->format);
-			tex->width = t->width;
-			tex->height = t->height;
+			tex->width = get16bit_LE((u8*)&t->width);
+			tex->height = get16bit_LE((u8*)&t->height);
 			tex->opaque = t->opaque;
 
+			tex->size = 0;
 			tex->data = NULL;
 
-			if(t->image_ofs >= texturesize) {
+			if(image_ofs >= texturesize) {
 				printf("invalid texel offset for texture %d\n", i);
 				continue;
 			}
 
-			u8* texels = (u8*) ((uintptr_t)texturedata + (uintptr_t)t->image_ofs);
-			tex->data = (u8*) malloc(t->imagesize);
+			u8* texels = (u8*) ((uintptr_t)texturedata + (uintptr_t)image_ofs);
+			tex->size = imagesize;
+			tex->data = (u8*) malloc(imagesize);
 			if(!tex->data)
 				fatal("not enough memory");
-			memcpy(tex->data, texels, t->imagesize);
+			memcpy(tex->data, texels, imagesize);
 		}
 	}
 
 	if(rawheader->meshes) {
 		scene->num_dlists = 0;
 		for(i = 0; i < scene->num_meshes; i++) {
-			Mesh* mesh = &meshes[i];
-			mesh->matid = get16bit_LE((u8*)&mesh->matid);
-			mesh->dlistid = get16bit_LE((u8*)&mesh->dlistid);
-			if(mesh->dlistid >= scene->num_dlists)
-				scene->num_dlists = mesh->dlistid + 1;
-			Dlist* dlist = &dlists[mesh->dlistid];
-			dlist->start_ofs = get32bit_LE((u8*)&dlist->start_ofs);
-			dlist->size = get32bit_LE((u8*)&dlist->size);
-			u32* data = (u32*) (scenedata + dlist->start_ofs);
-			u32* end = data + dlist->size / 4;
-			while(data < end) {
-				*data = get32bit_LE((u8*)data);
-				data++;
-			}
+			u16 dlistid = get16bit_LE((u8*)&meshes[i].dlistid);
+			if(dlistid >= scene->num_dlists)
+				scene->num_dlists = dlistid + 1;
 		}
-
-		scene->dlists = (int*) malloc(scene->num_dlists * sizeof(int));
-		for(i = 0; i < scene->num_dlists; i++)
-			scene->dlists[i] = -1;
-	} else {
-		scene->dlists = NULL;
 	}
+	scene->dlists = NULL;
+	scene->vbo = 0;
+	scene->ibo = 0;
+	scene->pos_shift = 0;
 
 	if(scene->textures) {
-		make_textures(scene);
+		decode_textures(scene);
 	}
 
 	if(rawheader->meshes) {
@@ -1531,6 +2113,7 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 	if(rawheader->nodes) {
 		scene->apply_transform = 1;
 		CModel_compute_node_matrices(scene, 0);
+		CModel_update_node_bounds(scene);
 	}
 
 #if 0
@@ -1547,19 +2130,49 @@ CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsi
 	return scene;
 }
 
+/* creates the GL textures and buffers, needs the GL context */
+void CModel_upload(CModel* model)
+{
+	upload_textures(model);
+	if(model->geometry) {
+		upload_meshes(model);
+		free_geometry(model);
+	}
+}
+
+CModel* CModel_load(u8* scenedata, unsigned int scenesize, u8* texturedata, unsigned int texturesize, int layer_mask)
+{
+	CModel* scene = CModel_parse(scenedata, scenesize, texturedata, texturesize, layer_mask);
+	CModel_upload(scene);
+	return scene;
+}
+
+/* re-decodes the material images, e.g. after palettes have been swapped */
+void CModel_decode_textures(CModel* model)
+{
+	if(!model->textures)
+		return;
+
+	decode_textures(model);
+}
+
 void CModel_set_textures(CModel* model)
 {
 	if(!model->textures)
 		return;
 
-	make_textures(model);
+	decode_textures(model);
+	upload_textures(model);
 }
 
 void CModel_set_texture_filter(CModel* model, int type)
 {
 	u32 m;
 	for(m = 0; m < model->num_materials; m++) {
-		if(model->materials[m].texid != 0xFFFF) {
+		if(model->materials[m].indexed) {
+			/* filtered by the shader */
+			model->materials[m].filter = type == GL_LINEAR;
+		} else if(model->materials[m].texid != 0xFFFF) {
 			glBindTexture(GL_TEXTURE_2D, model->materials[m].tex);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, type);
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, type);
@@ -1648,42 +2261,137 @@ void CModel_compute_node_matrices(CModel* model, int start_idx)
 	}
 }
 
-CModel* CModel_load_file(const char* model, const char* textures, int layer_mask)
+/* node bounds from the bounds of its meshes and node_transform, call after CModel_compute_node_matrices */
+void CModel_update_node_bounds(CModel* model)
+{
+	unsigned int i, j;
+
+	for(i = 0; i < model->num_nodes; i++) {
+		CNode* node = &model->nodes[i];
+		int mesh_id = node->mesh_id / 2;
+
+		clear_bounds(node->bounds);
+		if(!model->meshes)
+			continue;
+		for(j = 0; j < node->mesh_count && mesh_id + j < model->num_meshes; j++) {
+			float bounds[3][2];
+			MTX44TransformBounds(&node->node_transform, model->meshes[mesh_id + j].bounds, bounds);
+			merge_bounds(node->bounds, bounds);
+		}
+	}
+}
+
+/* bounds of a mesh after transform, or as decoded if transform is NULL; min > max if the mesh is empty */
+void CModel_get_mesh_bounds(CModel* model, int mesh_id, const Mtx44* transform, float bounds[3][2])
+{
+	if(transform)
+		MTX44TransformBounds(transform, model->meshes[mesh_id].bounds, bounds);
+	else
+		memcpy(bounds, model->meshes[mesh_id].bounds, sizeof(float[3][2]));
+}
+
+/* bounds of a node's meshes in model space */
+void CModel_get_node_bounds(CModel* model, int node_idx, float bounds[3][2])
+{
+	memcpy(bounds, model->nodes[node_idx].bounds, sizeof(float[3][2]));
+}
+
+/* opaque meshes without alpha tested texels can hide what is behind them */
+bool CModel_mesh_is_occluder(CModel* model, int mesh_id)
+{
+	CMaterial* mat = &model->materials[model->meshes[mesh_id].matid];
+
+	if(mat->render_mode != NORMAL || mat->alpha < 31)
+		return false;
+	return mat->texid == 0xFFFF || model->textures[mat->texid].opaque;
+}
+
+/* writes the triangles of a mesh after transform as x, y, z per corner with
+   the visible side counter-clockwise, twice for double sided materials;
+   returns the number of triangles, vertices may be NULL to count them.
+   Only before CModel_upload, which frees the geometry */
+unsigned int CModel_get_mesh_triangles(CModel* model, int mesh_id, const Mtx44* transform, float* vertices)
+{
+	CMesh* mesh = &model->meshes[mesh_id];
+	int culling = model->materials[mesh->matid].culling;
+	unsigned int num_triangles;
+	CGeometry* geo;
+	unsigned int i, j;
+
+	if(!model->geometry)
+		return 0;
+
+	geo = &model->geometry[mesh->dlistid];
+	num_triangles = geo->num_indices / 3;
+	if(culling == DOUBLE_SIDED)
+		num_triangles *= 2;
+	if(!vertices)
+		return num_triangles;
+
+	for(i = 0; i + 2 < geo->num_indices; i += 3) {
+		Vec3 p[3];
+		for(j = 0; j < 3; j++) {
+			const float* pos = geo->vertices[geo->indices[i + j]].pos;
+			Vec3 v = { pos[0], pos[1], pos[2] };
+			MTX44MultVec(transform, &v, &p[j]);
+		}
+		if(culling != BACK_SIDE) {
+			for(j = 0; j < 3; j++, vertices += 3) {
+				vertices[0] = p[j].x;
+				vertices[1] = p[j].y;
+				vertices[2] = p[j].z;
+			}
+		}
+		if(culling != FRONT_SIDE) {
+			for(j = 3; j-- > 0; vertices += 3) {
+				vertices[0] = p[j].x;
+				vertices[1] = p[j].y;
+				vertices[2] = p[j].z;
+			}
+		}
+	}
+
+	return num_triangles;
+}
+
+static u8* map_host_file(const char* path, FSMapMode mode, u32* size)
 {
-	FILE* file = fopen(model, "rb");
-	if(!file) {
-		printf("%s not found\n", model);
+	FSFile file;
+	u8* data;
+
+	FS_InitFile(&file);
+	if(!FS_OpenHostFile(&file, path)) {
+		printf("%s not found\n", path);
+		exit(1);
+	}
+
+	*size = FS_GetLength(&file);
+	data = (u8*) FS_MapFile(&file, mode);
+	if(!data) {
+		printf("failed to map %s\n", path);
 		exit(1);
 	}
 
-	fseek(file, 0, SEEK_END);
-	u32 scenesize = ftell(file);
-	fseek(file, 0, SEEK_SET);
-	u8* content = (u8*) malloc(scenesize);
-	fread(content, 1, scenesize, file);
-	fclose(file);
+	FS_CloseFile(&file);
+	return data;
+}
+
+CModel* CModel_load_file(const char* model, const char* textures, int layer_mask)
+{
+	u32 scenesize;
+	u8* content = map_host_file(model, FS_MAP_READ, &scenesize);
 
 	u32 texturesize = scenesize;
 	u8* texturedata = content;
 
 	if(textures != NULL) {
-		file = fopen(textures, "rb");
-		if(!file) {
-			printf("%s not found\n", textures);
-			exit(1);
-		}
-		fseek(file, 0, SEEK_END);
-		texturesize = ftell(file);
-		fseek(file, 0, SEEK_SET);
-		texturedata = (u8*) malloc(texturesize);
-		fread(texturedata, 1, texturesize, file);
-		fclose(file);
+		texturedata = map_host_file(textures, FS_MAP_READ, &texturesize);
 	}
 
 	CModel* scene = CModel_load(content, scenesize, texturedata, texturesize, layer_mask);
 	if(texturedata != content)
-		free(texturedata);
-	free(content);
+		FS_UnmapFile(texturedata, texturesize);
+	FS_UnmapFile(content, scenesize);
 	return scene;
 }
 
@@ -1691,34 +2399,41 @@ void CModel_free(CModel* scene)
 {
 	unsigned int i;
 	for(i = 0; i < scene->num_materials; i++) {
-		glDeleteTextures(1, &scene->materials[i].tex);
+		release_entries(&scene->materials[i]);
 	}
-	for(i = 0; i < scene->num_dlists; i++) {
-		glDeleteLists(1, scene->dlists[i]);
+	for(i = 0; i < scene->num_materials; i++) {
+		model_free(scene, scene->materials[i].image);
+	}
+	if(scene->vbo) {
+		glDeleteBuffers(1, &scene->vbo);
+		glDeleteBuffers(1, &scene->ibo);
 	}
+	free_geometry(scene);
 	for(i = 0; i < scene->num_textures; i++) {
-		free(scene->textures[i].data);
+		model_free(scene, scene->textures[i].data);
 	}
 	for(i = 0; i < scene->num_palettes; i++) {
-		free(scene->palettes[i].data);
+		model_free(scene, scene->palettes[i].data);
 	}
-	free(scene->textures);
-	free(scene->palettes);
-	free(scene->materials);
-	free(scene->meshes);
+	model_free(scene, scene->textures);
+	model_free(scene, scene->palettes);
+	model_free(scene, scene->materials);
+	model_free(scene, scene->meshes);
 	free(scene->dlists);
-	free(scene->nodes);
-	free(scene->node_pos);
-	free(scene->node_initial_pos);
+	model_free(scene, scene->nodes);
+	model_free(scene, scene->node_pos);
+	model_free(scene, scene->node_initial_pos);
+	if(scene->baked)
+		FS_UnmapFile(scene->baked, scene->baked_size);
 	free(scene);
 }
 
 static void use_room_lights()
 {
-	glUniform3fv(light1vec, 1, l1v);
-	glUniform3fv(light1col, 1, l1c);
-	glUniform3fv(light2vec, 1, l2v);
-	glUniform3fv(light2col, 1, l2c);
+	GLSUniform3fv(light1vec, 1, l1v);
+	GLSUniform3fv(light1col, 1, l1c);
+	GLSUniform3fv(light2vec, 1, l2v);
+	GLSUniform3fv(light2col, 1, l2c);
 }
 
 extern bool lighting;
@@ -1747,13 +2462,14 @@ void CModel_render_mesh(CModel* scene, int mesh_id, Mtx44* transform)
 		process_material_animation(scene->material_animations, material.material_anim_id, &material);
 	}
 
-	float diff[3] = { material.diffuse.r / 31.0f, material.diffuse.g / 31.0f, material.diffuse.b / 31.0f };
-	glColor3fv(diff);
+	float diff[4] = { material.diffuse.r / 31.0f, material.diffuse.g / 31.0f, material.diffuse.b / 31.0f, 1.0f };
+	/* also the color of vertices without one */
+	GLSUniform3fv(diffuse, 1, diff);
 
 	if(material.texid != 0xFFFF) {
 		Mtx44 texcoord;
 
-		glBindTexture(GL_TEXTURE_2D, material.tex);
+		GLSBindTexture(0, material.tex);
 
 		if(scene->texcoord_animations && material.texcoord_anim_id != -1) {
 			process_texcoord_animation(scene->texcoord_animations, material.texcoord_anim_id, texture->width, texture->height, &texcoord);
@@ -1775,23 +2491,30 @@ void CModel_render_mesh(CModel* scene, int mesh_id, Mtx44* transform)
 			MTX44Scale(&texcoord, 1.0f / texture->width, 1.0f / texture->height, 1.0f);
 		}
 
-		glUniform1i(use_texture, texturing);
-		glUniformMatrix4fv(texcoord_matrix, 1, 0, texcoord.a);
+		if(material.indexed) {
+			/* a palette swap is just another texture here */
+			GLSBindTexture(1, material.palette_tex);
+			GLSUniform2f(tex_size, texture->width, texture->height);
+			GLSUniform1i(tex_filter, material.filter);
+		}
+
+		GLSUniform1i(use_texture, texturing);
+		GLSUniform1i(use_palette, material.indexed);
+		GLSUniformMatrix4fv(texcoord_matrix, 1, texcoord.a);
 	} else {
-		glBindTexture(GL_TEXTURE_2D, 0);
-		glUniform1i(use_texture, 0);
+		GLSUniform1i(use_texture, 0);
+		GLSUniform1i(use_palette, 0);
 	}
 
 	if(lighting && material.light) {
-		float amb[3] = { (float)material.ambient.r / 31.0f, (float)material.ambient.g / 31.0f, (float)material.ambient.b / 31.0f };
+		float amb[4] = { (float)material.ambient.r / 31.0f, (float)material.ambient.g / 31.0f, (float)material.ambient.b / 31.0f, 1.0f };
 		float spec[3] = { material.specular.r / 31.0f, material.specular.g / 31.0f, material.specular.b / 31.0f };
-		glEnable(GL_LIGHTING);
-		glMaterialfv(GL_FRONT, GL_AMBIENT, amb);
-		glMaterialfv(GL_FRONT, GL_DIFFUSE, diff);
-		glUniform3fv(ambient, 1, amb);
-		glUniform3fv(diffuse, 1, diff);
-		glUniform3fv(specular, 1, spec);
-		glUniform1i(use_light, 1);
+		GLSEnable(GL_LIGHTING, true);
+		GLSMaterialfv(GL_AMBIENT, amb);
+		GLSMaterialfv(GL_DIFFUSE, diff);
+		GLSUniform3fv(ambient, 1, amb);
+		GLSUniform3fv(specular, 1, spec);
+		GLSUniform1i(use_light, 1);
 		if (scene->light_override) {
 			Mtx44 light_transform;
 			Vec3 pos;
@@ -1822,65 +2545,81 @@ void CModel_render_mesh(CModel* scene, int mesh_id, Mtx44* transform)
 			l1v_override[0] = light_vec.x;
 			l1v_override[1] = light_vec.y;
 			l1v_override[2] = light_vec.z;
-			glUniform3fv(light1vec, 1, l1v_override);
+			GLSUniform3fv(light1vec, 1, l1v_override);
 			MTX44MultVec(&light_transform, &octo_vec2, &light_vec);
 			VEC_Normalize3(&light_vec, &light_vec);
 			l2v_override[0] = light_vec.x;
 			l2v_override[1] = light_vec.y;
 			l2v_override[2] = light_vec.z;
-			glUniform3fv(light2vec, 1, l2v_override);
+			GLSUniform3fv(light2vec, 1, l2v_override);
 			l1c_override[0] = 1;
 			l1c_override[1] = 1;
 			l1c_override[2] = 1;
 			l2c_override[0] = 1;
 			l2c_override[1] = 1;
 			l2c_override[2] = 1;
-			glUniform3fv(light1col, 1, l1c_override);
-			glUniform3fv(light2col, 1, l2c_override);
+			GLSUniform3fv(light1col, 1, l1c_override);
+			GLSUniform3fv(light2col, 1, l2c_override);
 		} else {
 			use_room_lights();
 		}
 	} else {
-		glUniform1i(use_light, 0);
+		GLSUniform1i(use_light, 0);
 	}
 
 	switch(material.culling) {
 		case DOUBLE_SIDED:
-			glDisable(GL_CULL_FACE);
+			GLSEnable(GL_CULL_FACE, false);
 			break;
 		case BACK_SIDE:
-			glEnable(GL_CULL_FACE);
-			glCullFace(GL_FRONT);
+			GLSEnable(GL_CULL_FACE, true);
+			GLSCullFace(GL_FRONT);
 			break;
 		case FRONT_SIDE:
-			glEnable(GL_CULL_FACE);
-			glCullFace(GL_BACK);
+			GLSEnable(GL_CULL_FACE, true);
+			GLSCullFace(GL_BACK);
 			break;
 	}
 
-	glCallList(scene->dlists[mesh->dlistid]);
+	CDrawRange* range = &scene->dlists[mesh->dlistid];
+	/* the attribute layout is the same for every model, only the buffer changes */
+	if(GLSBindBuffer(GL_ARRAY_BUFFER, scene->vbo)) {
+		if(packed_normals()) {
+			glVertexAttribPointer(ATTR_POSITION, 4, GL_SHORT, GL_FALSE, sizeof(GLVertex), (void*) offsetof(GLVertex, pos));
+			glVertexAttribPointer(ATTR_TEXCOORD, 2, GL_SHORT, GL_FALSE, sizeof(GLVertex), (void*) offsetof(GLVertex, uv));
+			glVertexAttribPointer(ATTR_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_FALSE, sizeof(GLVertex), (void*) offsetof(GLVertex, normal));
+			glVertexAttribPointer(ATTR_COLOR, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(GLVertex), (void*) offsetof(GLVertex, color));
+		} else {
+			glVertexAttribPointer(ATTR_POSITION, 4, GL_SHORT, GL_FALSE, sizeof(GLVertexShortNormal), (void*) offsetof(GLVertexShortNormal, pos));
+			glVertexAttribPointer(ATTR_TEXCOORD, 2, GL_SHORT, GL_FALSE, sizeof(GLVertexShortNormal), (void*) offsetof(GLVertexShortNormal, uv));
+			glVertexAttribPointer(ATTR_NORMAL, 3, GL_SHORT, GL_FALSE, sizeof(GLVertexShortNormal), (void*) offsetof(GLVertexShortNormal, normal));
+			glVertexAttribPointer(ATTR_COLOR, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(GLVertexShortNormal), (void*) offsetof(GLVertexShortNormal, color));
+		}
+	}
+	GLSBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene->ibo);
+	GLSUniform1f(pos_scale, (1 << scene->pos_shift) / 4096.0f);
+	glDrawElements(GL_TRIANGLES, range->count, GL_UNSIGNED_INT, (void*) (range->first * sizeof(unsigned int)));
 
 	if(lighting) {
-		glDisable(GL_LIGHTING);
+		GLSEnable(GL_LIGHTING, false);
 	}
 }
 
 static void CModel_update_uniforms()
 {
 	use_room_lights();
-	glUniform1i(fog_enable, fogen && !fogdis);
-	glUniform4fv(fog_color, 1, fogcol);
-	glUniform1f(fog_min, fogmin);
-	glUniform1f(fog_max, fogmax);
-	glUniform1f(alpha_scale, 1.0f);
-	glUniformMatrix4fv(proj_matrix, 1, 0, projection.a);
-	glUniformMatrix4fv(view_matrix, 1, 0, view.a);
-	glUniform3fv(toon_table, TOON_SIZE, toon_values);
+	GLSUniform1i(fog_enable, fogen && !fogdis);
+	GLSUniform4fv(fog_color, 1, fogcol);
+	GLSUniform1f(fog_min, fogmin);
+	GLSUniform1f(fog_max, fogmax);
+	GLSUniform1f(alpha_scale, 1.0f);
+	GLSUniformMatrix4fv(proj_matrix, 1, projection.a);
+	GLSUniformMatrix4fv(view_matrix, 1, view.a);
+	GLSUniform3fv(toon_table, TOON_SIZE, toon_values);
 }
 
 typedef struct RenderEntity RenderEntity;
 struct RenderEntity {
-	RenderEntity*	next;
 	Mtx44		transform;
 	Mtx44*		mtx_stack;
 	CModel*		model;
@@ -1893,23 +2632,46 @@ struct RenderEntity {
 	unsigned int	polygon_id;
 };
 
-typedef struct MatrixStack MatrixStack;
-struct MatrixStack {
-	MatrixStack* next;
-	Mtx44* matrices;
+/*
+	The draws of a frame are queued in a flat array and drawn in the order
+	of a 64 bit key per draw, radix sorted once in CModel_end_scene. The
+	top bits are the pass group, so every pass draws one contiguous range:
+
+	opaque		group:2 cull:2 variant:3 texture:16 palette:16 depth:25
+	translucent	group:2 depth:32 (back to front)
+	decal		group:2 depth:32 (back to front)
+
+	Opaque draws are grouped by GL state and go front to back within one
+	state, the blended ones go back to front. Ties keep submission order.
+*/
+enum {
+	GROUP_OPAQUE = 0,
+	GROUP_TRANSLUCENT,
+	GROUP_DECAL
 };
 
+typedef struct {
+	u64		key;
+	unsigned int	index;
+} RenderKey;
+
+Arena frame_arena;
+
+/* in frame_arena, the capacity is kept to start the next frame big enough */
 static unsigned int next_polygon_id;
 static unsigned int render_count;
+static unsigned int render_capacity = 1024;
 static RenderEntity* render_list;
-static RenderEntity* last_render_node;
-static MatrixStack* matrix_stacks;
+static RenderKey* render_keys;
+static RenderKey* render_keys_tmp;
 
+/* center of the mesh, the depth key for translucent sorting */
 static void RenderEntity_get_position(RenderEntity* ent, Vec3* pos)
 {
-	float cx = (ent->model->max_x + ent->model->min_x) / 2.0;
-	float cy = (ent->model->max_y + ent->model->min_y) / 2.0;
-	float cz = (ent->model->max_z + ent->model->min_z) / 2.0;
+	CMesh* mesh = &ent->model->meshes[ent->mesh];
+	float cx = (mesh->bounds[0][1] + mesh->bounds[0][0]) / 2.0;
+	float cy = (mesh->bounds[1][1] + mesh->bounds[1][0]) / 2.0;
+	float cz = (mesh->bounds[2][1] + mesh->bounds[2][0]) / 2.0;
 	Vec3 pt = { cx, cy, cz };
 	MTX44MultVec(&ent->transform, &pt, pos);
 }
@@ -1924,193 +2686,460 @@ static float RenderEntity_get_distance(RenderEntity* ent)
 	return -sqrtf(dx * dx + dy * dy + dz * dz);
 }
 
-static int RenderEntity_sort(const void* a, const void* b)
+/* distances are positive, so their bits order like unsigned integers */
+static u32 RenderEntity_get_depth(RenderEntity* ent)
 {
-	RenderEntity* x = *(RenderEntity**) a;
-	RenderEntity* y = *(RenderEntity**) b;
+	union {
+		float	f;
+		u32	u;
+	} dist;
+	dist.f = -RenderEntity_get_distance(ent);
+	return dist.u;
+}
 
-	float dst1 = RenderEntity_get_distance(x);
-	float dst2 = RenderEntity_get_distance(y);
+static u64 RenderEntity_get_key(RenderEntity* ent)
+{
+	CMaterial* mat = &ent->model->materials[ent->model->meshes[ent->mesh].matid];
+	u32 depth = RenderEntity_get_depth(ent);
+	u64 variant, tex = 0, palette = 0;
+
+	if(ent->mode == DECAL)
+		return ((u64) GROUP_DECAL << 62) | ((u64) (~depth) << 30);
+	if(ent->mode >= TRANSLUCENT)
+		return ((u64) GROUP_TRANSLUCENT << 62) | ((u64) (~depth) << 30);
+
+	if(mat->texid != 0xFFFF) {
+		tex = mat->tex & 0xFFFF;
+		palette = mat->indexed ? mat->palette_tex & 0xFFFF : 0;
+	}
+	variant = (mat->texid != 0xFFFF) | (mat->indexed << 1) | ((lighting && mat->light) << 2);
+	return	((u64) GROUP_OPAQUE << 62) | ((u64) (mat->culling & 3) << 60) | (variant << 57) |
+		(tex << 41) | (palette << 25) | (depth >> 6);
+}
 
-	if(dst1 == dst2)
-		return 0;
-	else if(dst1 < dst2)
-		return 1;
-	else
-		return -1;
+/* stable LSD radix sort by key, a byte per pass; passes over a byte that is
+   the same in every key are skipped. Returns keys or tmp, whichever ends up sorted */
+static RenderKey* sort_keys(RenderKey* keys, RenderKey* tmp, unsigned int n)
+{
+	unsigned int count[8][256];
+	unsigned int i, b;
+
+	memset(count, 0, sizeof(count));
+	for(i = 0; i < n; i++) {
+		for(b = 0; b < 8; b++)
+			count[b][(keys[i].key >> (b * 8)) & 0xFF]++;
+	}
+
+	for(b = 0; b < 8; b++) {
+		unsigned int* c = count[b];
+		unsigned int sum = 0;
+		RenderKey* swap;
+
+		if(c[(keys[0].key >> (b * 8)) & 0xFF] == n)
+			continue;
+
+		for(i = 0; i < 256; i++) {
+			unsigned int k = c[i];
+			c[i] = sum;
+			sum += k;
+		}
+		for(i = 0; i < n; i++)
+			tmp[c[(keys[i].key >> (b * 8)) & 0xFF]++] = keys[i];
+
+		swap = keys;
+		keys = tmp;
+		tmp = swap;
+	}
+	return keys;
+}
+
+static void alloc_render_list(void)
+{
+	render_list = (RenderEntity*) alloc_from_arena(&frame_arena, render_capacity * sizeof(RenderEntity));
+	render_keys = (RenderKey*) alloc_from_arena(&frame_arena, render_capacity * sizeof(RenderKey));
+	render_keys_tmp = (RenderKey*) alloc_from_arena(&frame_arena, render_capacity * sizeof(RenderKey));
 }
 
 void CModel_begin_scene(void)
 {
-	render_list = NULL;
-	last_render_node = NULL;
-	matrix_stacks = NULL;
+	reset_arena(&frame_arena);
+	alloc_render_list();
 	render_count = 0;
 	next_polygon_id = 1;
+	CULLBeginFrame(&projection, &view);
+	OCCLBeginFrame(&projection, &view);
 }
 
 static void RenderEntity_render(RenderEntity* ent)
 {
-	glUniform1i(mat_mode, ent->poly_mode);
-	glUniform1f(alpha_scale, ent->alpha);
-	glUniform1f(mat_alpha, ent->mat_alpha / 31.0f);
+	GLSUniform1i(mat_mode, ent->poly_mode);
+	GLSUniform1f(alpha_scale, ent->alpha);
+	GLSUniform1f(mat_alpha, ent->mat_alpha / 31.0f);
 	current_node = ent->node;
 	if (ent->model->num_node_weight == 0) {
-		glUniformMatrix4fv(matrix_stack, 1, 0, ent->transform.a);
+		GLSUniformMatrix4fv(matrix_stack, 1, ent->transform.a);
 	} else {
-		glUniformMatrix4fv(matrix_stack, ent->model->num_node_weight, 0, ent->mtx_stack->a);
+		GLSUniformMatrix4fv(matrix_stack, ent->model->num_node_weight, ent->mtx_stack->a);
 	}
 	CModel_render_mesh(ent->model, ent->mesh, &ent->transform);
 }
 
-void CModel_end_scene(void)
-{
-	if(!render_count)
-		return;
-
-	unsigned int polygon_id = 4;
-	RenderEntity* ent = render_list;
-	RenderEntity** sorted = (RenderEntity**)alloc_from_heap(render_count * sizeof(RenderEntity*));
-	unsigned int i = 0;
+/* the depth buffer after the opaque pass, copied aside in a renderbuffer */
+static GLuint depth_fbo;
+static GLuint depth_rb;
+static GLint depth_rect[4];
+static bool depth_checked;
 
-	// collect all nodes
-	while(ent) {
-		sorted[i++] = ent;
-		ent = ent->next;
+static bool save_depth(void)
+{
+	GLint vp[4];
+
+	if(!depth_snapshots)
+		return false;
+
+	glGetIntegerv(GL_VIEWPORT, vp);
+	if(!depth_fbo || vp[2] != depth_rect[2] || vp[3] != depth_rect[3]) {
+		GLint samples = 0;
+		GLenum status;
+
+		/* depth can not be blitted back into a multisampled buffer */
+		glGetIntegerv(GL_SAMPLE_BUFFERS, &samples);
+		if(samples > 0) {
+			printf("multisampled depth buffer, drawing the opaque depth again\n");
+			depth_snapshots = false;
+			return false;
+		}
+		if(!depth_fbo) {
+			glGenFramebuffers(1, &depth_fbo);
+			glGenRenderbuffers(1, &depth_rb);
+		}
+		glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, vp[2], vp[3]);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if(status != GL_FRAMEBUFFER_COMPLETE) {
+			printf("depth snapshot framebuffer incomplete (%04X), drawing the opaque depth again\n", status);
+			depth_snapshots = false;
+			return false;
+		}
+		depth_checked = false;
 	}
+	memcpy(depth_rect, vp, sizeof(vp));
+
+	/* the default depth format may not match, which only shows as an error */
+	if(!depth_checked)
+		while(glGetError() != GL_NO_ERROR);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo);
+	glBlitFramebuffer(vp[0], vp[1], vp[0] + vp[2], vp[1] + vp[3], 0, 0, vp[2], vp[3], GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if(!depth_checked) {
+		if(glGetError() != GL_NO_ERROR) {
+			printf("cannot copy the depth buffer, drawing the opaque depth again\n");
+			depth_snapshots = false;
+			return false;
+		}
+		depth_checked = true;
+	}
+	return true;
+}
 
-	// depth sort
-	// qsort(sorted, render_count, sizeof(RenderEntity*), RenderEntity_sort);
-
-	glUseProgram(shader);
-
-	CModel_update_uniforms();
-
-	//////////////////////////////////////////////////////////////////
-	// pass 1: opaque
-	//////////////////////////////////////////////////////////////////
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glEnable(GL_ALPHA_TEST);
-	glAlphaFunc(GL_EQUAL, 1.0f);
-	glDepthFunc(GL_LESS);
-	glDepthMask(GL_TRUE);
-	glEnable(GL_STENCIL_TEST);
-	glStencilMask(0xFF);
-	glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
-	glStencilFunc(GL_ALWAYS, 0, 0xFF);
-	for(i = 0; i < render_count; i++) {
-		RenderEntity* ent = sorted[i];
-		if(ent->mode != DECAL)
-			RenderEntity_render(ent);
-	}
-	glDisable(GL_ALPHA_TEST);
+/* only depth, the stencil marks of pass 3 stay */
+static void restore_depth(void)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, depth_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, depth_rect[2], depth_rect[3], depth_rect[0], depth_rect[1], depth_rect[0] + depth_rect[2], depth_rect[1] + depth_rect[3], GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	//////////////////////////////////////////////////////////////////
-	// pass 2: decal
-	//////////////////////////////////////////////////////////////////
-	glEnable(GL_POLYGON_OFFSET_FILL);
-	glPolygonOffset(-1, -1);
-	glDepthFunc(GL_LEQUAL);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	for(i = 0; i < render_count; i++) {
-		RenderEntity* ent = sorted[i];
-		if(ent->mode == DECAL)
-			RenderEntity_render(ent);
-	}
-	glPolygonOffset(0, 0);
-	glDisable(GL_POLYGON_OFFSET_FILL);
+/* passes 3 to 6, sorted[first..end) are the translucent draws and
+   everything before them the opaque ones */
+static void render_translucent(RenderKey* sorted, unsigned int first, unsigned int end, bool depth_saved)
+{
+	unsigned int i;
 
 	//////////////////////////////////////////////////////////////////
 	// pass 3: mark transparent faces in stencil
 	//////////////////////////////////////////////////////////////////
-	glEnable(GL_ALPHA_TEST);
-	glAlphaFunc(GL_LESS, 1.0f);
-	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	for(i = 0; i < render_count; i++) {
-		RenderEntity* ent = sorted[i];
-		if(ent->mode >= TRANSLUCENT) {
-			glStencilFunc(GL_GREATER, ent->polygon_id, 0xFF);
-			RenderEntity_render(ent);
-		}
+	GLSEnable(GL_ALPHA_TEST, true);
+	GLSAlphaFunc(GL_LESS, 1.0f);
+	GLSColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	GLSStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	for(i = first; i < end; i++) {
+		RenderEntity* ent = &render_list[sorted[i].index];
+		GLSStencilFunc(GL_GREATER, ent->polygon_id, 0xFF);
+		RenderEntity_render(ent);
 	}
 
 	//////////////////////////////////////////////////////////////////
 	// pass 4: rebuild depth buffer
 	//////////////////////////////////////////////////////////////////
-	glClear(GL_DEPTH_BUFFER_BIT);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-	glStencilFunc(GL_ALWAYS, 0, 0xFF);
-	glAlphaFunc(GL_EQUAL, 1.0f);
-	for(i = 0; i < render_count; i++) {
-		RenderEntity* ent = sorted[i];
-		if(ent->mode != DECAL)
-			RenderEntity_render(ent);
+	GLSStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	GLSStencilFunc(GL_ALWAYS, 0, 0xFF);
+	if(depth_saved) {
+		restore_depth();
+	} else {
+		glClear(GL_DEPTH_BUFFER_BIT);
+		GLSAlphaFunc(GL_EQUAL, 1.0f);
+		for(i = 0; i < end; i++)
+			RenderEntity_render(&render_list[sorted[i].index]);
 	}
 
 	//////////////////////////////////////////////////////////////////
 	// pass 5: translucent (behind)
 	//////////////////////////////////////////////////////////////////
-	glAlphaFunc(GL_LESS, 1.0f);
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDepthMask(GL_FALSE);
-	glDepthFunc(GL_LEQUAL);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-	for(i = 0; i < render_count; i++) {
-		RenderEntity* ent = sorted[i];
-		if(ent->mode >= TRANSLUCENT) {
-			glStencilFunc(GL_NOTEQUAL, ent->polygon_id, 0xFF);
-			RenderEntity_render(ent);
-		}
+	GLSAlphaFunc(GL_LESS, 1.0f);
+	GLSColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	GLSDepthMask(GL_FALSE);
+	GLSDepthFunc(GL_LEQUAL);
+	GLSStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	for(i = first; i < end; i++) {
+		RenderEntity* ent = &render_list[sorted[i].index];
+		GLSStencilFunc(GL_NOTEQUAL, ent->polygon_id, 0xFF);
+		RenderEntity_render(ent);
 	}
 
 	//////////////////////////////////////////////////////////////////
 	// pass 6: translucent (before)
 	//////////////////////////////////////////////////////////////////
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-	for(i = 0; i < render_count; i++) {
-		RenderEntity* ent = sorted[i];
-		if(ent->mode >= TRANSLUCENT) {
-			glStencilFunc(GL_EQUAL, ent->polygon_id, 0xFF);
-			RenderEntity_render(ent);
-		}
+	GLSStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	for(i = first; i < end; i++) {
+		RenderEntity* ent = &render_list[sorted[i].index];
+		GLSStencilFunc(GL_EQUAL, ent->polygon_id, 0xFF);
+		RenderEntity_render(ent);
 	}
+}
 
-	glDepthMask(GL_TRUE);
-	glDisable(GL_BLEND);
-	glDisable(GL_ALPHA_TEST);
-	glDisable(GL_STENCIL_TEST);
+/* weighted color and alpha sums of the translucent layers, with the
+   depth snapshot as their depth buffer */
+static GLuint oit_fbo;
+static GLuint oit_accum;
+static GLuint oit_alpha;
+static GLint oit_size[2];
 
-	glUseProgram(0);
+static GLuint oit_texture(GLuint tex, GLint width, GLint height)
+{
+	if(!tex)
+		glGenTextures(1, &tex);
+	GLSBindTexture(0, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+	return tex;
+}
 
-	// release
-	for(i = 0; i < render_count; i++) {
-		free_to_heap(sorted[i]);
+static bool bind_oit_targets(void)
+{
+	static const GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+	if(!oit_fbo || oit_size[0] != depth_rect[2] || oit_size[1] != depth_rect[3]) {
+		GLenum status;
+
+		if(!oit_fbo)
+			glGenFramebuffers(1, &oit_fbo);
+		oit_accum = oit_texture(oit_accum, depth_rect[2], depth_rect[3]);
+		oit_alpha = oit_texture(oit_alpha, depth_rect[2], depth_rect[3]);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, oit_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, oit_accum, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, oit_alpha, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+		glDrawBuffers(2, buffers);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if(status != GL_FRAMEBUFFER_COMPLETE) {
+			printf("translucency framebuffer incomplete (%04X), sorting by stencil\n", status);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			oit_targets = false;
+			return false;
+		}
+		oit_size[0] = depth_rect[2];
+		oit_size[1] = depth_rect[3];
 	}
 
-	MatrixStack* stack = matrix_stacks;
-	while (stack) {
-		struct MatrixStack* next = stack->next;
-		free_to_heap(stack->matrices);
-		free_to_heap(stack);
-		stack = next;
+	glBindFramebuffer(GL_FRAMEBUFFER, oit_fbo);
+	glViewport(0, 0, oit_size[0], oit_size[1]);
+	return true;
+}
+
+extern bool weighted_oit;
+
+/* weighted blended order independent transparency (McGuire and Bavoil,
+   2013) in place of passes 3 to 6: one pass sums the translucent layers,
+   weighted by depth, and one full screen pass resolves them over the frame.
+   No stencil, so no limit on polygon ids. Needs the depth snapshot */
+static bool render_weighted(RenderKey* sorted, unsigned int first, unsigned int end)
+{
+	GLfloat clear[4];
+	GLint polygon_mode[2];
+	GLboolean depth_test;
+	unsigned int i;
+
+	if(!oit_targets || !bind_oit_targets())
+		return false;
+
+	/* the alpha sum starts from what is left of the last layer in accum */
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+	GLSColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(clear[0], clear[1], clear[2], clear[3]);
+
+	//////////////////////////////////////////////////////////////////
+	// accumulate: colors add up, alpha multiplies to the revealage
+	//////////////////////////////////////////////////////////////////
+	GLSEnable(GL_STENCIL_TEST, false);
+	GLSEnable(GL_ALPHA_TEST, true);
+	GLSAlphaFunc(GL_LESS, 1.0f);
+	GLSDepthMask(GL_FALSE);
+	GLSDepthFunc(GL_LEQUAL);
+	GLSEnable(GL_BLEND, true);
+	GLSBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+	GLSUniform1i(oit_enable, 1);
+	for(i = first; i < end; i++)
+		RenderEntity_render(&render_list[sorted[i].index]);
+	GLSUniform1i(oit_enable, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(depth_rect[0], depth_rect[1], depth_rect[2], depth_rect[3]);
+
+	//////////////////////////////////////////////////////////////////
+	// composite: average color over what shows through
+	//////////////////////////////////////////////////////////////////
+	depth_test = glIsEnabled(GL_DEPTH_TEST);
+	glGetIntegerv(GL_POLYGON_MODE, polygon_mode);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	GLSUseProgram(composite_shader);
+	GLSBindTexture(0, oit_accum);
+	GLSBindTexture(1, oit_alpha);
+	GLSEnable(GL_DEPTH_TEST, false);
+	GLSEnable(GL_ALPHA_TEST, false);
+	GLSEnable(GL_CULL_FACE, false);
+	GLSBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+	glBegin(GL_TRIANGLE_STRIP);
+	glVertex2f(-1.0f, -1.0f);
+	glVertex2f(1.0f, -1.0f);
+	glVertex2f(-1.0f, 1.0f);
+	glVertex2f(1.0f, 1.0f);
+	glEnd();
+
+	glPolygonMode(GL_FRONT_AND_BACK, polygon_mode[0]);
+	GLSEnable(GL_DEPTH_TEST, depth_test);
+	GLSBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLSUseProgram(shader);
+	return true;
+}
+
+void CModel_end_scene(void)
+{
+	if(!render_count)
+		return;
+
+	RenderKey* sorted = sort_keys(render_keys, render_keys_tmp, render_count);
+	unsigned int translucent_start, decal_start;
+	unsigned int i;
+
+	for(translucent_start = 0; translucent_start < render_count && (sorted[translucent_start].key >> 62) == GROUP_OPAQUE; translucent_start++)
+		;
+	for(decal_start = translucent_start; decal_start < render_count && (sorted[decal_start].key >> 62) == GROUP_TRANSLUCENT; decal_start++)
+		;
+
+	/* passes without draws are skipped, without translucency that is 3 to 6 */
+	bool translucent = translucent_start < decal_start;
+	bool decals = decal_start < render_count;
+	bool depth_saved = false;
+
+	GLSBeginFrame();
+	GLSUseProgram(shader);
+	glEnableVertexAttribArray(ATTR_POSITION);
+	glEnableVertexAttribArray(ATTR_TEXCOORD);
+	glEnableVertexAttribArray(ATTR_NORMAL);
+	glEnableVertexAttribArray(ATTR_COLOR);
+
+	CModel_update_uniforms();
+
+	//////////////////////////////////////////////////////////////////
+	// pass 1: opaque
+	//////////////////////////////////////////////////////////////////
+	GLSColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	GLSEnable(GL_ALPHA_TEST, true);
+	GLSAlphaFunc(GL_EQUAL, 1.0f);
+	GLSDepthFunc(GL_LESS);
+	GLSDepthMask(GL_TRUE);
+	GLSEnable(GL_STENCIL_TEST, true);
+	GLSStencilMask(0xFF);
+	GLSStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+	GLSStencilFunc(GL_ALWAYS, 0, 0xFF);
+	for(i = 0; i < decal_start; i++)
+		RenderEntity_render(&render_list[sorted[i].index]);
+	GLSEnable(GL_ALPHA_TEST, false);
+
+	/* what pass 4 needs, before decals and translucency write depth */
+	if(translucent)
+		depth_saved = save_depth();
+
+	//////////////////////////////////////////////////////////////////
+	// pass 2: decal
+	//////////////////////////////////////////////////////////////////
+	GLSDepthFunc(GL_LEQUAL);
+	GLSEnable(GL_BLEND, true);
+	GLSBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if(decals) {
+		GLSEnable(GL_POLYGON_OFFSET_FILL, true);
+		GLSPolygonOffset(-1, -1);
+		for(i = decal_start; i < render_count; i++)
+			RenderEntity_render(&render_list[sorted[i].index]);
+		GLSPolygonOffset(0, 0);
+		GLSEnable(GL_POLYGON_OFFSET_FILL, false);
 	}
 
-	free_to_heap(sorted);
-	render_list = NULL;
-	last_render_node = NULL;
-	matrix_stacks = NULL;
+	if(translucent && !(weighted_oit && depth_saved && render_weighted(sorted, translucent_start, decal_start)))
+		render_translucent(sorted, translucent_start, decal_start, depth_saved);
+
+	GLSDepthMask(GL_TRUE);
+	GLSEnable(GL_BLEND, false);
+	GLSEnable(GL_ALPHA_TEST, false);
+	GLSEnable(GL_STENCIL_TEST, false);
+
+	glDisableVertexAttribArray(ATTR_POSITION);
+	glDisableVertexAttribArray(ATTR_TEXCOORD);
+	glDisableVertexAttribArray(ATTR_NORMAL);
+	glDisableVertexAttribArray(ATTR_COLOR);
+	GLSBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLSBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	GLSBindTexture(1, 0);
+	GLSBindTexture(0, 0);
+	GLSUseProgram(0);
+	GLSEndFrame();
+
+	/* all of it goes with the next reset of frame_arena */
+	render_count = 0;
 }
 
-void CModel_add_model(CModel* scene, Mtx44* mtx, MatrixStack* mtx_stack, CNode* node, int mesh, float alpha, float mat_alpha, int mode, int poly_mode, int polygon_id)
+void CModel_add_model(CModel* scene, Mtx44* mtx, Mtx44* mtx_stack, CNode* node, int mesh, float alpha, float mat_alpha, int mode, int poly_mode, int polygon_id)
 {
-	RenderEntity* ent = (RenderEntity*)alloc_from_heap(sizeof(RenderEntity));
-	if (mtx_stack) {
-		ent->mtx_stack = mtx_stack->matrices;
-	} else {
-		MTX44Copy(mtx, &ent->transform);
+	if(render_count == render_capacity) {
+		/* the old arrays stay in the arena until the next frame */
+		RenderEntity* list = render_list;
+		RenderKey* keys = render_keys;
+		render_capacity *= 2;
+		alloc_render_list();
+		memcpy(render_list, list, render_count * sizeof(RenderEntity));
+		memcpy(render_keys, keys, render_count * sizeof(RenderKey));
 	}
+
+	RenderEntity* ent = &render_list[render_count];
+	ent->mtx_stack = mtx_stack;
+	MTX44Copy(mtx, &ent->transform);
 	ent->model = scene;
 	ent->node = node;
 	ent->mesh = mesh;
@@ -2119,24 +3148,43 @@ void CModel_add_model(CModel* scene, Mtx44* mtx, MatrixStack* mtx_stack, CNode*
 	ent->mode = mode;
 	ent->poly_mode = poly_mode;
 	ent->polygon_id = polygon_id;
-	ent->next = NULL;
-	if(!render_list) {
-		render_list = ent;
-		last_render_node = ent;
-	} else {
-		last_render_node->next = ent;
-		last_render_node = ent;
-	}
+	render_keys[render_count].key = RenderEntity_get_key(ent);
+	render_keys[render_count].index = render_count;
+	cull_stats.submitted++;
 	render_count++;
 	if(polygon_id > 255)
 		printf("ERROR! %d\n", polygon_id);
 }
 
+static bool bounds_visible(const float bounds[3][2])
+{
+	if(!CULLTestBounds(bounds)) {
+		cull_stats.frustum_culled++;
+		return false;
+	}
+	if(!OCCLTestBounds(bounds)) {
+		cull_stats.occluded++;
+		return false;
+	}
+	return true;
+}
+
+static bool mesh_visible(CMesh* mesh, Mtx44* transform)
+{
+	float bounds[3][2];
+	MTX44TransformBounds(transform, mesh->bounds, bounds);
+	return bounds_visible(bounds);
+}
+
 void CModel_render_all(CModel* scene, Mtx44* mtx, float alpha)
 {
 	Mtx44 mat;
 	unsigned int i, j;
 
+	/* still being loaded */
+	if(!scene)
+		return;
+
 	MTX44Scale(&mat, scene->scale, scene->scale, scene->scale);
 	MTX44Concat(mtx, &mat, &mat);
 
@@ -2148,15 +3196,12 @@ void CModel_render_all(CModel* scene, Mtx44* mtx, float alpha)
 	if(next_polygon_id > 255)
 		next_polygon_id = 0;
 
-	MatrixStack* stack = NULL;
+	Mtx44* stack = NULL;
 	if (scene->num_node_weight > 0) {
-		stack = (MatrixStack*)malloc(sizeof(MatrixStack));
-		stack->matrices = (Mtx44*)malloc(scene->num_node_weight * sizeof(Mtx44));
+		stack = (Mtx44*)alloc_from_arena(&frame_arena, scene->num_node_weight * sizeof(Mtx44));
 		for (int i = 0; i < scene->num_node_weight; i++) {
-			MTX44Identity(&stack->matrices[i]);
+			MTX44Identity(&stack[i]);
 		}
-		stack->next = matrix_stacks;
-		matrix_stacks = stack;
 	}
 
 	for(i = 0; i < scene->num_nodes; i++) {
@@ -2185,7 +3230,7 @@ void CModel_render_all(CModel* scene, Mtx44* mtx, float alpha)
 
 		for (j = 0; j < scene->num_node_weight; j++) {
 			if (scene->node_weight_ids[j] == i) {
-				MTX44Copy(&transform, &stack->matrices[j]);
+				MTX44Copy(&transform, &stack[j]);
 				break;
 			}
 		}
@@ -2196,45 +3241,36 @@ void CModel_render_all(CModel* scene, Mtx44* mtx, float alpha)
 				int id = mesh_id + j;
 				CMesh* mesh = &scene->meshes[id];
 				CMaterial* material = &scene->materials[mesh->matid];
+				/* skinned vertices do not follow the node transform */
+				if(!stack && !mesh_visible(mesh, &transform))
+					continue;
 				CModel_add_model(scene, &transform, stack, node, id, alpha, material->alpha, material->render_mode, material->polygon_mode, polygon_id);
 			}
 		}
 	}
 }
 
-void CModel_render_node(CModel* scene, Mtx44* mtx, int node_idx, float alpha)
+/* queues one mesh of a node without any culling, mtx is the room transform */
+void CModel_render_node_mesh(CModel* scene, Mtx44* mtx, int node_idx, int mesh_id, float alpha)
 {
 	Mtx44 mat;
-	unsigned int i, j;
+	Mtx44 transform;
+	CNode* node = &scene->nodes[node_idx];
+	CMaterial* material = &scene->materials[scene->meshes[mesh_id].matid];
+	unsigned int polygon_id = 0;
 
 	MTX44Scale(&mat, scene->scale, scene->scale, scene->scale);
 	MTX44Concat(mtx, &mat, &mat);
+	if(scene->apply_transform)
+		MTX44Concat(&mat, &node->node_transform, &transform);
+	else
+		MTX44Copy(&mat, &transform);
 
-	for(i = node_idx; i != -1; i = scene->nodes[i].next) {
-		Mtx44 transform;
-		CNode* node = &scene->nodes[i];
-		if(node->mesh_count > 0 && node->enabled == 1) {
-			int mesh_id = node->mesh_id / 2;
-
-			if(scene->apply_transform) {
-				MTX44Concat(&mat, &node->node_transform, &transform);
-			} else {
-				MTX44Copy(&mat, &transform);
-			}
-
-			for(j = 0; j < node->mesh_count; j++) {
-				int id = mesh_id + j;
-				CMesh* mesh = &scene->meshes[id];
-				CMaterial* material = &scene->materials[mesh->matid];
-				unsigned int polygon_id = 0;
-				if(material->render_mode >= TRANSLUCENT)
-					polygon_id = next_polygon_id++;
-				CModel_add_model(scene, &transform, NULL, node, id, alpha, material->alpha, material->render_mode, material->polygon_mode, polygon_id);
-				if(next_polygon_id > 255)
-					next_polygon_id = 0;
-			}
-		}
-	}
+	if(material->render_mode >= TRANSLUCENT)
+		polygon_id = next_polygon_id++;
+	CModel_add_model(scene, &transform, NULL, node, mesh_id, alpha, material->alpha, material->render_mode, material->polygon_mode, polygon_id);
+	if(next_polygon_id > 255)
+		next_polygon_id = 0;
 }
 
 const float toon_values[TOON_SIZE * 3] = {
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <string.h>
 #include "types.h"
 #include "mtx.h"
 
@@ -218,3 +219,26 @@ void MTX44ClearRot(const Mtx44* src, Mtx44* dst)
 	dst->_32 = src->_32;
 	dst->_33 = src->_33;
 }
+
+/* axis aligned box around the transformed box src (Arvo), empty boxes (min > max) stay empty */
+void MTX44TransformBounds(const Mtx44* m, const float src[3][2], float dst[3][2])
+{
+	int i, j;
+	float out[3][2];
+
+	if(src[0][0] > src[0][1]) {
+		memcpy(dst, src, sizeof(out));
+		return;
+	}
+
+	for(i = 0; i < 3; i++) {
+		out[i][0] = out[i][1] = m->m[3][i];
+		for(j = 0; j < 3; j++) {
+			float a = m->m[j][i] * src[j][0];
+			float b = m->m[j][i] * src[j][1];
+			out[i][0] += a < b ? a : b;
+			out[i][1] += a < b ? b : a;
+		}
+	}
+	memcpy(dst, out, sizeof(out));
+}
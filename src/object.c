@@ -10,6 +10,7 @@
 #include "entity.h"
 #include "os.h"
 #include "heap.h"
+#include "loader.h"
 
 #define NUM_OBJECTS	54
 
@@ -91,9 +92,74 @@ void link_model(CModel* model, SHARED_TEXTURE container_id, int copy_textures)
 	}
 }
 
+static void object_ready(CModel* model, void* arg)
+{
+	char filename[64];
+	unsigned int id = (unsigned int) (uintptr_t) arg;
+
+	// if(objects[id].unk_flag)
+	// 	object_model[id]->flags |= 1u;
+	if(id == 41) {
+		if(object_model[41]->textures)
+			OS_Terminate();
+		load_texture_container(object_model[41], ALIMBIC_TXTR);
+	} else if(id >= 0xC && id <= 0x10) {
+		if(object_model[id]->textures)
+			OS_Terminate();
+		load_texture_container(object_model[id], GENERIC_EQUIP_TXTR);
+	} else if(id >= 0x11 && id <= 0x15) {
+		if(object_model[id]->textures)
+			OS_Terminate();
+		load_texture_container(object_model[id], ALIMBIC_EQUIP_TXTR);
+	} else if(id >= 0x16 && id <= 0x1A) {
+		if(object_model[id]->textures)
+			OS_Terminate();
+		load_texture_container(object_model[id], LAVA_EQUIP_TXTR);
+	} else if(id >= 0x1B && id <= 0x1F) {
+		if(object_model[id]->textures)
+			OS_Terminate();
+		load_texture_container(object_model[id], ICE_EQUIP_TXTR);
+	} else if(id >= 0x20 && id <= 0x24) {
+		if(object_model[id]->textures)
+			OS_Terminate();
+		load_texture_container(object_model[id], RUINS_EQUIP_TXTR);
+	} else if(id >= 0x2F && id <= 0x34) {
+		link_model(object_model[id], SECRET_SWITCH_TXTR, 1);
+	} else if(id == 45) {
+		// load_collision(&alimbic_capsule_shield_collision, "models/AlmbCapsuleShld_Collision.bin", 0);
+		object_model[45]->texture_matrices = (Mtx44*) alloc_from_heap(sizeof(Mtx44));
+		object_model[45]->texture_matrices->m[0][0] = 0;
+		object_model[45]->texture_matrices->m[0][1] = 0;
+		object_model[45]->texture_matrices->m[0][2] = 0;
+		object_model[45]->texture_matrices->m[1][0] = -0.5; // FX_FX32_TO_F32(-2048);
+		object_model[45]->texture_matrices->m[1][1] = 0;
+		object_model[45]->texture_matrices->m[1][2] = 0;
+		object_model[45]->texture_matrices->m[2][0] = 0.1;  // FX_FX32_TO_F32(410);
+		object_model[45]->texture_matrices->m[2][1] = -0.95; // FX_FX32_TO_F32(-3891);
+		object_model[45]->texture_matrices->m[2][2] = 0;
+		object_model[45]->texture_matrices->m[3][0] = 0;
+		object_model[45]->texture_matrices->m[3][1] = 0;
+		object_model[45]->texture_matrices->m[3][2] = 0;
+	}
+	if(objects[id].anim_name && !object_anim[id]) {
+		sprintf(filename, "models/%s_Anim.bin", objects[id].anim_name);
+		load_animation(&object_anim[id], filename, object_model[id], 0);
+	}
+	// if(objects[id].collision_name && !object_collision[id]) {
+	// 	sprintf(filename, "models/%s_Collision.bin", objects[id].collision_name);
+	// 	load_collision(&object_collision[id], filename, 0);
+	// }
+	if(id >= 0x2F && id <= 0x34) {
+		int i;
+		for(i = 47; i < 0x34; i = (i + 1) & 0xFF) {
+			object_anim[i] = object_anim[id];
+			// object_collision[i] = object_collision[id];
+		}
+	}
+}
+
 void load_object(unsigned int id)
 {
-	const char* model_name;
 	char filename[64];
 
 	if(loaded[id])
@@ -102,67 +168,7 @@ void load_object(unsigned int id)
 
 	if(!object_model[id] && objects[id].model_name) {
 		sprintf(filename, "models/%s_Model.bin", objects[id].model_name);
-		printf("Loading model %s\n", filename);
-		load_model(&object_model[id], filename, 0);
-		// if(objects[id].unk_flag)
-		// 	object_model[id]->flags |= 1u;
-		if(id == 41) {
-			if(object_model[41]->textures)
-				OS_Terminate();
-			load_texture_container(object_model[41], ALIMBIC_TXTR);
-		} else if(id >= 0xC && id <= 0x10) {
-			if(object_model[id]->textures)
-				OS_Terminate();
-			load_texture_container(object_model[id], GENERIC_EQUIP_TXTR);
-		} else if(id >= 0x11 && id <= 0x15) {
-			if(object_model[id]->textures)
-				OS_Terminate();
-			load_texture_container(object_model[id], ALIMBIC_EQUIP_TXTR);
-		} else if(id >= 0x16 && id <= 0x1A) {
-			if(object_model[id]->textures)
-				OS_Terminate();
-			load_texture_container(object_model[id], LAVA_EQUIP_TXTR);
-		} else if(id >= 0x1B && id <= 0x1F) {
-			if(object_model[id]->textures)
-				OS_Terminate();
-			load_texture_container(object_model[id], ICE_EQUIP_TXTR);
-		} else if(id >= 0x20 && id <= 0x24) {
-			if(object_model[id]->textures)
-				OS_Terminate();
-			load_texture_container(object_model[id], RUINS_EQUIP_TXTR);
-		} else if(id >= 0x2F && id <= 0x34) {
-			link_model(object_model[id], SECRET_SWITCH_TXTR, 1);
-		} else if(id == 45) {
-			// load_collision(&alimbic_capsule_shield_collision, "models/AlmbCapsuleShld_Collision.bin", 0);
-			object_model[45]->texture_matrices = (Mtx44*) alloc_from_heap(sizeof(Mtx44));
-			object_model[45]->texture_matrices->m[0][0] = 0;
-			object_model[45]->texture_matrices->m[0][1] = 0;
-			object_model[45]->texture_matrices->m[0][2] = 0;
-			object_model[45]->texture_matrices->m[1][0] = -0.5; // FX_FX32_TO_F32(-2048);
-			object_model[45]->texture_matrices->m[1][1] = 0;
-			object_model[45]->texture_matrices->m[1][2] = 0;
-			object_model[45]->texture_matrices->m[2][0] = 0.1;  // FX_FX32_TO_F32(410);
-			object_model[45]->texture_matrices->m[2][1] = -0.95; // FX_FX32_TO_F32(-3891);
-			object_model[45]->texture_matrices->m[2][2] = 0;
-			object_model[45]->texture_matrices->m[3][0] = 0;
-			object_model[45]->texture_matrices->m[3][1] = 0;
-			object_model[45]->texture_matrices->m[3][2] = 0;
-		}
-		if(objects[id].anim_name && !object_anim[id]) {
-			sprintf(filename, "models/%s_Anim.bin", objects[id].anim_name);
-			load_animation(&object_anim[id], filename, object_model[id], 0);
-		}
-		// if(objects[id].collision_name && !object_collision[id]) {
-		// 	sprintf(filename, "models/%s_Collision.bin", objects[id].collision_name);
-		// 	load_collision(&object_collision[id], filename, 0);
-		// }
-		if(id >= 0x2F && id <= 0x34) {
-			int i;
-			for(i = 47; i < 0x34; i = (i + 1) & 0xFF) {
-				object_anim[i] = object_anim[id];
-				// object_collision[i] = object_collision[id];
-			}
-		}
+		load_model_async(&object_model[id], filename, 0, object_ready, (void*) (uintptr_t) id);
 	}
 }
 
@@ -0,0 +1,294 @@
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "types.h"
+#include "mtx.h"
+#include "cull.h"
+#include "occlusion.h"
+
+/*
+
+	Occlusion culling
+
+	A small depth buffer the CPU rasterizes the frame's occluders into. It
+	holds 1/w, which interpolates linearly across the screen, so 0 is
+	infinitely far away and larger values are nearer. A box is hidden if
+	every pixel its screen rectangle touches has an occluder nearer than
+	the nearest corner of the box. The buffer is split into tiles that
+	keep their farthest depth, most boxes are decided by those alone.
+
+	Only pixel centers are rasterized and triangles facing away are
+	skipped, the same as the GPU does with back face culling on.
+
+*/
+
+#define OCCL_WIDTH	256
+#define OCCL_HEIGHT	128
+#define TILE_SIZE	8
+#define TILES_X		(OCCL_WIDTH / TILE_SIZE)
+#define TILES_Y		(OCCL_HEIGHT / TILE_SIZE)
+
+static float depth[OCCL_HEIGHT][OCCL_WIDTH];
+static float tile_depth[TILES_Y][TILES_X];
+static bool tiles_dirty;
+static unsigned int num_rasterized;
+static Mtx44 clip;
+
+void OCCLBeginFrame(const Mtx44* projection, const Mtx44* view)
+{
+	MTX44Concat(projection, view, &clip);
+	memset(depth, 0, sizeof(depth));
+	memset(tile_depth, 0, sizeof(tile_depth));
+	tiles_dirty = false;
+	num_rasterized = 0;
+}
+
+static void to_clip(const float p[3], float c[4])
+{
+	int i;
+	/* m[col][row] */
+	for(i = 0; i < 4; i++)
+		c[i] = clip.m[0][i] * p[0] + clip.m[1][i] * p[1] + clip.m[2][i] * p[2] + clip.m[3][i];
+}
+
+/* clip space corners, in front of the near plane */
+static void raster_triangle(const float* c0, const float* c1, const float* c2)
+{
+	const float* c[3] = { c0, c1, c2 };
+	float v[3][3];
+	float A[3], B[3], C[3];
+	float zA, zB, zC;
+	float area, minx, maxx, miny, maxy;
+	int x0, x1, y0, y1, x, y, i;
+
+	/* screen x, y and 1/w */
+	for(i = 0; i < 3; i++) {
+		float iw = 1.0f / c[i][3];
+		v[i][0] = (c[i][0] * iw * 0.5f + 0.5f) * OCCL_WIDTH;
+		v[i][1] = (c[i][1] * iw * 0.5f + 0.5f) * OCCL_HEIGHT;
+		v[i][2] = iw;
+	}
+
+	area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+	if(area <= 0.0f)
+		return;
+
+	minx = fminf(v[0][0], fminf(v[1][0], v[2][0]));
+	maxx = fmaxf(v[0][0], fmaxf(v[1][0], v[2][0]));
+	miny = fminf(v[0][1], fminf(v[1][1], v[2][1]));
+	maxy = fmaxf(v[0][1], fmaxf(v[1][1], v[2][1]));
+	if(maxx < 0.0f || maxy < 0.0f || minx >= OCCL_WIDTH || miny >= OCCL_HEIGHT)
+		return;
+
+	x0 = minx < 0.0f ? 0 : (int) minx;
+	y0 = miny < 0.0f ? 0 : (int) miny;
+	x1 = maxx >= OCCL_WIDTH ? OCCL_WIDTH - 1 : (int) maxx;
+	y1 = maxy >= OCCL_HEIGHT ? OCCL_HEIGHT - 1 : (int) maxy;
+	/* whole groups of 4 pixels */
+	x0 &= ~3;
+
+	/* edge functions, positive inside; edge i is opposite corner i + 2 */
+	zA = zB = zC = 0.0f;
+	for(i = 0; i < 3; i++) {
+		const float* a = v[i];
+		const float* b = v[(i + 1) % 3];
+		float z = v[(i + 2) % 3][2] / area;
+		A[i] = a[1] - b[1];
+		B[i] = b[0] - a[0];
+		C[i] = -(A[i] * a[0] + B[i] * a[1]);
+		zA += A[i] * z;
+		zB += B[i] * z;
+		zC += C[i] * z;
+	}
+
+	for(y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		float* row = depth[y];
+#ifdef __SSE2__
+		__m128 e0 = _mm_set1_ps(B[0] * py + C[0]);
+		__m128 e1 = _mm_set1_ps(B[1] * py + C[1]);
+		__m128 e2 = _mm_set1_ps(B[2] * py + C[2]);
+		__m128 ez = _mm_set1_ps(zB * py + zC);
+		__m128 a0 = _mm_set1_ps(A[0]);
+		__m128 a1 = _mm_set1_ps(A[1]);
+		__m128 a2 = _mm_set1_ps(A[2]);
+		__m128 az = _mm_set1_ps(zA);
+		__m128 zero = _mm_setzero_ps();
+
+		for(x = x0; x <= x1; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float) x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+			__m128 mask = _mm_and_ps(_mm_and_ps(
+				_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), e0), zero),
+				_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), e1), zero)),
+				_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), e2), zero));
+			__m128 old, z;
+
+			if(!_mm_movemask_ps(mask))
+				continue;
+
+			old = _mm_loadu_ps(row + x);
+			z = _mm_max_ps(old, _mm_add_ps(_mm_mul_ps(az, px), ez));
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, old)));
+		}
+#else
+		for(x = x0; x <= x1; x++) {
+			float px = x + 0.5f;
+			float z;
+			if(A[0] * px + B[0] * py + C[0] < 0.0f ||
+					A[1] * px + B[1] * py + C[1] < 0.0f ||
+					A[2] * px + B[2] * py + C[2] < 0.0f)
+				continue;
+			z = zA * px + zB * py + zC;
+			if(z > row[x])
+				row[x] = z;
+		}
+#endif
+	}
+
+	tiles_dirty = true;
+}
+
+void OCCLRenderOccluder(const COccluder* occluder)
+{
+	const float* p = occluder->vertices;
+	unsigned int i;
+
+	if(!occlusion_culling || !CULLTestBounds(occluder->bounds))
+		return;
+
+	for(i = 0; i < occluder->num_triangles; i++, p += 9) {
+		float in[3][4];
+		float out[4][4];
+		int j, n = 0;
+
+		for(j = 0; j < 3; j++)
+			to_clip(p + j * 3, in[j]);
+
+		/* Sutherland-Hodgman against the near plane z + w >= 0 */
+		for(j = 0; j < 3; j++) {
+			const float* a = in[j];
+			const float* b = in[(j + 1) % 3];
+			float da = a[2] + a[3];
+			float db = b[2] + b[3];
+			if(da >= 0.0f)
+				memcpy(out[n++], a, sizeof(float[4]));
+			if((da >= 0.0f) != (db >= 0.0f)) {
+				float t = da / (da - db);
+				int k;
+				for(k = 0; k < 4; k++)
+					out[n][k] = a[k] + t * (b[k] - a[k]);
+				n++;
+			}
+		}
+
+		for(j = 1; j + 1 < n; j++) {
+			if(out[0][3] > 1e-6f && out[j][3] > 1e-6f && out[j + 1][3] > 1e-6f)
+				raster_triangle(out[0], out[j], out[j + 1]);
+		}
+	}
+
+	num_rasterized++;
+}
+
+/* the farthest depth of every tile */
+static void update_tiles(void)
+{
+	int tx, ty, x, y;
+
+	for(ty = 0; ty < TILES_Y; ty++) {
+		for(tx = 0; tx < TILES_X; tx++) {
+#ifdef __SSE2__
+			__m128 m = _mm_set1_ps(FLT_MAX);
+			float r[4];
+			for(y = ty * TILE_SIZE; y < (ty + 1) * TILE_SIZE; y++) {
+				for(x = tx * TILE_SIZE; x < (tx + 1) * TILE_SIZE; x += 4)
+					m = _mm_min_ps(m, _mm_loadu_ps(&depth[y][x]));
+			}
+			_mm_storeu_ps(r, m);
+			tile_depth[ty][tx] = fminf(fminf(r[0], r[1]), fminf(r[2], r[3]));
+#else
+			float m = FLT_MAX;
+			for(y = ty * TILE_SIZE; y < (ty + 1) * TILE_SIZE; y++) {
+				for(x = tx * TILE_SIZE; x < (tx + 1) * TILE_SIZE; x++)
+					m = fminf(m, depth[y][x]);
+			}
+			tile_depth[ty][tx] = m;
+#endif
+		}
+	}
+
+	tiles_dirty = false;
+}
+
+bool OCCLTestBounds(const float bounds[3][2])
+{
+	float minx = FLT_MAX, miny = FLT_MAX;
+	float maxx = -FLT_MAX, maxy = -FLT_MAX;
+	float nearest = 0.0f;
+	int x0, x1, y0, y1, tx, ty, x, y, i;
+
+	if(!occlusion_culling || !num_rasterized)
+		return true;
+
+	/* empty box */
+	if(bounds[0][0] > bounds[0][1])
+		return true;
+
+	for(i = 0; i < 8; i++) {
+		float p[3] = { bounds[0][i & 1], bounds[1][(i >> 1) & 1], bounds[2][(i >> 2) & 1] };
+		float c[4], iw, sx, sy;
+
+		to_clip(p, c);
+		/* reaching past the near plane, nothing can be in front of it */
+		if(c[2] + c[3] < 0.0f || c[3] <= 1e-6f)
+			return true;
+
+		iw = 1.0f / c[3];
+		sx = (c[0] * iw * 0.5f + 0.5f) * OCCL_WIDTH;
+		sy = (c[1] * iw * 0.5f + 0.5f) * OCCL_HEIGHT;
+		minx = fminf(minx, sx);
+		maxx = fmaxf(maxx, sx);
+		miny = fminf(miny, sy);
+		maxy = fmaxf(maxy, sy);
+		nearest = fmaxf(nearest, iw);
+	}
+
+	/* off screen, that is for the frustum test to decide */
+	if(maxx < 0.0f || maxy < 0.0f || minx >= OCCL_WIDTH || miny >= OCCL_HEIGHT)
+		return true;
+
+	x0 = minx < 0.0f ? 0 : (int) minx;
+	y0 = miny < 0.0f ? 0 : (int) miny;
+	x1 = maxx >= OCCL_WIDTH ? OCCL_WIDTH - 1 : (int) maxx;
+	y1 = maxy >= OCCL_HEIGHT ? OCCL_HEIGHT - 1 : (int) maxy;
+
+	if(tiles_dirty)
+		update_tiles();
+
+	for(ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ty++) {
+		for(tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; tx++) {
+			int px0, px1, py0, py1;
+
+			if(tile_depth[ty][tx] > nearest)
+				continue;
+
+			px0 = tx * TILE_SIZE > x0 ? tx * TILE_SIZE : x0;
+			px1 = tx * TILE_SIZE + TILE_SIZE - 1 < x1 ? tx * TILE_SIZE + TILE_SIZE - 1 : x1;
+			py0 = ty * TILE_SIZE > y0 ? ty * TILE_SIZE : y0;
+			py1 = ty * TILE_SIZE + TILE_SIZE - 1 < y1 ? ty * TILE_SIZE + TILE_SIZE - 1 : y1;
+			for(y = py0; y <= py1; y++) {
+				for(x = px0; x <= px1; x++) {
+					if(depth[y][x] <= nearest)
+						return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
@@ -2,19 +2,180 @@
 #include <GL/glext.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
 
 #include "types.h"
 #include "mtx.h"
 #include "heap.h"
+#include "error.h"
 #include "room.h"
 #include "animation.h"
 #include "io.h"
 #include "entity.h"
 #include "model.h"
 #include "archive.h"
+#include "bvh.h"
+#include "cull.h"
+#include "world.h"
+#include "occlusion.h"
+
+/* triangles rasterized into the occlusion buffer per room and frame */
+#define	MAX_OCCLUDER_TRIANGLES	8192
 
 Entity* entities;
 
+static void room_matrix(CRoom* room, Mtx44* mtx)
+{
+	MTX44Trans(mtx, FX_FX32_TO_F32(room->pos.x), FX_FX32_TO_F32(room->pos.y), FX_FX32_TO_F32(room->pos.z));
+}
+
+/* the world transform of a node's meshes, as CModel_render_node_mesh builds it */
+static void node_matrix(CRoom* room, int node_id, Mtx44* transform)
+{
+	CModel* model = room->model;
+	Mtx44 mtx, scale;
+
+	room_matrix(room, &mtx);
+	MTX44Scale(&scale, model->scale, model->scale, model->scale);
+	MTX44Concat(&mtx, &scale, &mtx);
+
+	if(model->apply_transform)
+		MTX44Concat(&mtx, &model->nodes[node_id].node_transform, transform);
+	else
+		MTX44Copy(&mtx, transform);
+}
+
+/* one cell per room node, with a BVH over the meshes of its enabled nodes */
+static void build_room_cells(CRoom* room)
+{
+	CModel* model = room->model;
+	NodeRef* ref;
+	BVHItem* items;
+	int i, c;
+
+	room->num_cells = 0;
+	for(ref = room->room_nodes; ref; ref = ref->next)
+		room->num_cells++;
+
+	room->cells = (CRoomCell*) malloc(room->num_cells * sizeof(CRoomCell) + 1);
+	items = (BVHItem*) malloc(model->num_meshes * sizeof(BVHItem) + 1);
+	if(!room->cells || !items)
+		fatal_error("load_room: Not enough memory!\n");
+
+	for(ref = room->room_nodes, c = 0; ref; ref = ref->next, c++) {
+		CRoomCell* cell = &room->cells[c];
+		unsigned int count = 0;
+
+		for(i = ref->node_id; i != -1; i = model->nodes[i].next) {
+			CNode* node = &model->nodes[i];
+			Mtx44 transform;
+			unsigned int j;
+
+			if(node->mesh_count == 0 || node->enabled != 1)
+				continue;
+
+			node_matrix(room, i, &transform);
+			for(j = 0; j < node->mesh_count && count < model->num_meshes; j++) {
+				BVHItem* item = &items[count++];
+				item->node_id = i;
+				item->mesh_id = node->mesh_id / 2 + j;
+				CModel_get_mesh_bounds(model, item->mesh_id, &transform, item->bounds);
+			}
+		}
+
+		cell->node_id = ref->node_id;
+		cell->bvh = BVH_build(items, count);
+		cell->num_portals = 0;
+		cell->visible = true;
+		if(count) {
+			memcpy(cell->bounds, cell->bvh->nodes[0].bounds, sizeof(cell->bounds));
+		} else {
+			cell->bounds[0][0] = 1.0f;
+			cell->bounds[0][1] = -1.0f;
+		}
+	}
+
+	free(items);
+}
+
+typedef struct {
+	const BVHItem*	item;
+	float		area;
+} OccluderCandidate;
+
+static int compare_occluders(const void* a, const void* b)
+{
+	float x = ((const OccluderCandidate*) a)->area;
+	float y = ((const OccluderCandidate*) b)->area;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* the max_occluders opaque meshes with the largest boxes, within a triangle budget */
+static void build_room_occluders(CRoom* room)
+{
+	CModel* model = room->model;
+	OccluderCandidate* candidates;
+	unsigned int budget = MAX_OCCLUDER_TRIANGLES;
+	unsigned int num_candidates = 0;
+	unsigned int i, j;
+
+	room->occluders = NULL;
+	room->num_occluders = 0;
+	if(max_occluders <= 0)
+		return;
+
+	for(i = 0; i < room->num_cells; i++)
+		num_candidates += room->cells[i].bvh->num_items;
+
+	candidates = (OccluderCandidate*) malloc(num_candidates * sizeof(OccluderCandidate) + 1);
+	room->occluders = (COccluder*) malloc(max_occluders * sizeof(COccluder));
+	if(!candidates || !room->occluders)
+		fatal_error("load_room: Not enough memory!\n");
+
+	num_candidates = 0;
+	for(i = 0; i < room->num_cells; i++) {
+		BVH* bvh = room->cells[i].bvh;
+		for(j = 0; j < bvh->num_items; j++) {
+			const BVHItem* item = &bvh->items[j];
+			const float (*b)[2] = item->bounds;
+			float dx = b[0][1] - b[0][0];
+			float dy = b[1][1] - b[1][0];
+			float dz = b[2][1] - b[2][0];
+			if(!CModel_mesh_is_occluder(model, item->mesh_id))
+				continue;
+			candidates[num_candidates].item = item;
+			candidates[num_candidates].area = dx * dy + dy * dz + dz * dx;
+			num_candidates++;
+		}
+	}
+
+	qsort(candidates, num_candidates, sizeof(OccluderCandidate), compare_occluders);
+
+	for(i = 0; i < num_candidates && room->num_occluders < max_occluders; i++) {
+		const BVHItem* item = candidates[i].item;
+		COccluder* occluder;
+		Mtx44 transform;
+		unsigned int count = CModel_get_mesh_triangles(model, item->mesh_id, NULL, NULL);
+
+		if(!count || count > budget)
+			continue;
+
+		occluder = &room->occluders[room->num_occluders++];
+		occluder->vertices = (float*) malloc(count * 9 * sizeof(float));
+		if(!occluder->vertices)
+			fatal_error("load_room: Not enough memory!\n");
+
+		node_matrix(room, item->node_id, &transform);
+		occluder->num_triangles = CModel_get_mesh_triangles(model, item->mesh_id, &transform, occluder->vertices);
+		memcpy(occluder->bounds, item->bounds, sizeof(occluder->bounds));
+		budget -= count;
+	}
+
+	free(candidates);
+	printf("occluders: %d meshes, %u triangles\n", room->num_occluders, MAX_OCCLUDER_TRIANGLES - budget);
+}
+
 CRoom* load_room(const RoomDescription* descr, fx32 x, fx32 y, fx32 z, int layer_mask)
 {
 	int i;
@@ -46,9 +207,9 @@ CRoom* load_room(const RoomDescription* descr, fx32 x, fx32 y, fx32 z, int layer
 	if(descr->tex) {
 		flags = 0x20 | USE_EXTERNAL_TXTR | USE_ARCHIVE;
 		sprintf(txtrfilename, "levels/textures/%s", descr->tex);
-		load_room_model(&room->model, filename, txtrfilename, flags, room->layer_mask);
+		parse_room_model(&room->model, filename, txtrfilename, flags, room->layer_mask);
 	} else {
-		load_room_model(&room->model, filename, NULL, flags, room->layer_mask);
+		parse_room_model(&room->model, filename, NULL, flags, room->layer_mask);
 	}
 	// room->model->apply_transform = 0;
 
@@ -77,11 +238,20 @@ CRoom* load_room(const RoomDescription* descr, fx32 x, fx32 y, fx32 z, int layer
 		}
 	}
 
+	build_room_cells(room);
+	WORLDBuildCellPortals(room);
+	build_room_occluders(room);
+
+	/* frees the CPU side geometry, the occluders are copied out by now */
+	CModel_upload(room->model);
+
 	return room;
 }
 
 void CRoom_free(CRoom* room)
 {
+	int i;
+
 	if(room->model) {
 		CModel_free(room->model);
 		room->model = NULL;
@@ -99,6 +269,21 @@ void CRoom_free(CRoom* room)
 		}
 		room->room_nodes = NULL;
 	}
+	if(room->cells) {
+		for(i = 0; i < room->num_cells; i++)
+			BVH_free(room->cells[i].bvh);
+		free(room->cells);
+		room->cells = NULL;
+		room->num_cells = 0;
+	}
+	free(room->portals);
+	room->portals = NULL;
+	room->num_portals = 0;
+	for(i = 0; i < room->num_occluders; i++)
+		free(room->occluders[i].vertices);
+	free(room->occluders);
+	room->occluders = NULL;
+	room->num_occluders = 0;
 }
 
 void CRoom_setLights(CRoom* room)
@@ -127,17 +312,64 @@ void CRoom_setLights(CRoom* room)
 #endif
 }
 
+typedef struct {
+	CRoom*	room;
+	Mtx44	mtx;
+} RenderArgs;
+
+static void render_item(const BVHItem* item, void* arg)
+{
+	RenderArgs* args = (RenderArgs*) arg;
+	CModel_render_node_mesh(args->room->model, &args->mtx, item->node_id, item->mesh_id, 1.0);
+}
+
+extern float pos_x, pos_y, pos_z;
+
 void CRoom_render(CRoom* room)
 {
-	NodeRef* ref;
-	Mtx44 mtx;
+	RenderArgs args;
+	float eye[3] = { pos_x, pos_y, pos_z };
 	float fogcolor[4] = { COLOR_R(room->description->fog_color), COLOR_G(room->description->fog_color), COLOR_B(room->description->fog_color), 1 };
-	MTX44Trans(&mtx, FX_FX32_TO_F32(room->pos.x), FX_FX32_TO_F32(room->pos.y), FX_FX32_TO_F32(room->pos.z));
+	int i;
+
+	args.room = room;
+	room_matrix(room, &args.mtx);
 	CRoom_setLights(room);
 	CModel_setFog(room->description->fog_enable, fogcolor, room->description->fog_offset & 0x7FFF, room->description->fog_slope);
-	for(ref = room->room_nodes; ref; ref = ref->next) {
-		CModel_render_node(room->model, &mtx, ref->node_id, 1.0);
+
+	WORLDFindVisibleCells(room, eye);
+	for(i = 0; i < room->num_occluders; i++)
+		OCCLRenderOccluder(&room->occluders[i]);
+
+	for(i = 0; i < room->num_cells; i++) {
+		if(room->cells[i].visible)
+			BVH_cull(room->cells[i].bvh, render_item, &args);
+		else
+			cull_stats.portal_culled += room->cells[i].bvh->num_items;
+	}
+}
+
+/* the room mesh a world space ray hits first (by bounding box), -1 if none */
+int CRoom_pick(CRoom* room, const float origin[3], const float dir[3], int* node_id, float* t)
+{
+	int i;
+	int mesh_id = -1;
+	float best_t = FLT_MAX;
+
+	for(i = 0; i < room->num_cells; i++) {
+		BVH* bvh = room->cells[i].bvh;
+		float d;
+		int idx = BVH_raycast(bvh, origin, dir, &d);
+		if(idx >= 0 && d < best_t) {
+			best_t = d;
+			mesh_id = bvh->items[idx].mesh_id;
+			if(node_id)
+				*node_id = bvh->items[idx].node_id;
+		}
 	}
+	if(t)
+		*t = best_t;
+	return mesh_id;
 }
 
 void CRoom_process(CRoom* room, float dt)
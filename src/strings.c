@@ -41,13 +41,14 @@ void load_stringtable(const char* folder, const char* name, StringTable* dst)
 {
 	StringTableFile* out = NULL;
 	char filename[64];
+	int size;
 
 	sprintf(filename, "%s/%s", folder, name, 0);
-	LoadFile((void **)&out, filename);
+	size = MapFile((void **)&out, filename, FS_MAP_READ);
 	dst->length = out->length;
 	dst->entries = (StringTableEntry*) alloc_from_heap(dst->length * sizeof(StringTableEntry));
 	parse_stringtable(dst->entries, out->data, (char*) out, dst->length & 0xFFFF);
-	free_to_heap(out);
+	UnmapFile(out, size);
 }
 
 const char* search_string_by_id_internal(StringTable* strings, int id)
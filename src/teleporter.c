@@ -27,7 +27,7 @@ static void load_teleporter_model(void)
 			sprintf(filename, "models/Teleporter_pal_%02d_Model.bin", game_state.area_id + 1);
 			printf("Loading palette model %s...\n", filename);
 			load_model(&teleporter_pal_model, filename, 0);
-			if(teleporter_pal_model->dlists || teleporter_pal_model->textures)
+			if(teleporter_pal_model->num_dlists || teleporter_pal_model->textures)
 				OS_Terminate();
 		}
 
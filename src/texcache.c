@@ -0,0 +1,91 @@
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <GL/gl.h>
+
+#include "types.h"
+#include "error.h"
+#include "hash.h"
+#include "texcache.h"
+
+/*
+
+	Texture cache
+
+	Models that share texels and palettes (texture containers, the per
+	instance copies of doors and force fields, models loaded twice) end up
+	with the same decoded image. The cache maps everything an uploaded
+	texture depends on to one GL texture and counts its users, so each is
+	decoded and uploaded once. Lookups come from the loader threads,
+	textures are only added and deleted on the main thread.
+
+*/
+
+#define NUM_BUCKETS	1024
+
+static TexCacheEntry* buckets[NUM_BUCKETS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int bucket(const TexCacheKey* key)
+{
+	return (unsigned int) (fnv1a64(key, sizeof(TexCacheKey)) % NUM_BUCKETS);
+}
+
+TexCacheEntry* TEXCacheFind(const TexCacheKey* key)
+{
+	TexCacheEntry* entry;
+
+	pthread_mutex_lock(&lock);
+	for(entry = buckets[bucket(key)]; entry; entry = entry->next) {
+		if(!memcmp(&entry->key, key, sizeof(TexCacheKey))) {
+			entry->refs++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return entry;
+}
+
+TexCacheEntry* TEXCacheAdd(const TexCacheKey* key, unsigned int tex, bool translucent)
+{
+	unsigned int b = bucket(key);
+	TexCacheEntry* entry = (TexCacheEntry*) malloc(sizeof(TexCacheEntry));
+	if(!entry)
+		fatal_error("TEXCacheAdd: Not enough memory!\n");
+
+	entry->key = *key;
+	entry->tex = tex;
+	entry->translucent = translucent;
+	entry->refs = 1;
+
+	pthread_mutex_lock(&lock);
+	entry->next = buckets[b];
+	buckets[b] = entry;
+	pthread_mutex_unlock(&lock);
+
+	return entry;
+}
+
+void TEXCacheRelease(TexCacheEntry* entry)
+{
+	TexCacheEntry** p;
+
+	pthread_mutex_lock(&lock);
+	if(--entry->refs > 0) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	for(p = &buckets[bucket(&entry->key)]; *p != entry; p = &(*p)->next)
+		;
+	*p = entry->next;
+	pthread_mutex_unlock(&lock);
+
+	glDeleteTextures(1, &entry->tex);
+	free(entry);
+}
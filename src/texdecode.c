@@ -0,0 +1,276 @@
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "types.h"
+#include "model.h"
+#include "texdecode.h"
+
+/*
+
+	Texture decoding
+
+	Every format but direct colour is a table lookup: the palette is
+	expanded to RGBA8 once, with the alpha of each entry (index 0 of the
+	2/4/8 bit formats, the alpha bits of A3I5 and A5I3) and the material
+	alpha already applied, and the texels index it. Large 2 and 4 bit
+	textures go through a second table from a texel byte to the 4 or 2
+	pixels it holds. Every path ANDs the pixels it writes into one word,
+	its top byte tells if anything was translucent without another pass.
+	The indexed path hands out the same table and one byte per texel for
+	the GPU to do the lookup.
+
+	Alpha values come from the same float and double expressions as the
+	per texel code this replaced, so images are bit-identical.
+
+*/
+
+#define RGB555(c)	((((c) & 0x1F) << 3) | ((((c) >> 5) & 0x1F) << 11) | ((((c) >> 10) & 0x1F) << 19))
+
+/* below this many pixels building the byte tables costs more than it saves */
+#define MIN_BYTE_TABLE	1024
+
+static u32 palette_color(const CPalette* pal, unsigned int i)
+{
+	if(!pal || !pal->data || i >= pal->size / 2)
+		return 0;
+	return RGB555(pal->data[i]);
+}
+
+#ifdef __SSE2__
+static u32 and_reduce(__m128i v)
+{
+	v = _mm_and_si128(v, _mm_shuffle_epi32(v, 0x4E));
+	v = _mm_and_si128(v, _mm_shuffle_epi32(v, 0xB1));
+	return (u32) _mm_cvtsi128_si32(v);
+}
+#endif
+
+/* one texel per byte */
+static u32 lookup8(u32* image, const u8* texels, const u32* lut, u32 n)
+{
+	u32 acc = 0xFFFFFFFF;
+	u32 p = 0;
+
+#if defined(__AVX2__)
+	__m256i vacc = _mm256_set1_epi32(-1);
+	for(; p + 8 <= n; p += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (texels + p)));
+		__m256i v = _mm256_i32gather_epi32((const int*) lut, idx, 4);
+		_mm256_storeu_si256((__m256i*) (image + p), v);
+		vacc = _mm256_and_si256(vacc, v);
+	}
+	acc = and_reduce(_mm_and_si128(_mm256_castsi256_si128(vacc), _mm256_extracti128_si256(vacc, 1)));
+#elif defined(__SSE2__)
+	__m128i vacc = _mm_set1_epi32(-1);
+	for(; p + 4 <= n; p += 4) {
+		__m128i v = _mm_set_epi32(lut[texels[p + 3]], lut[texels[p + 2]], lut[texels[p + 1]], lut[texels[p]]);
+		_mm_storeu_si128((__m128i*) (image + p), v);
+		vacc = _mm_and_si128(vacc, v);
+	}
+	acc = and_reduce(vacc);
+#endif
+
+	for(; p < n; p++) {
+		image[p] = lut[texels[p]];
+		acc &= image[p];
+	}
+	return acc;
+}
+
+/* 8 / bits texels per byte, lowest bits first */
+static u32 lookup_packed(u32* image, const u8* texels, const u32* lut, u32 n, unsigned int bits)
+{
+	unsigned int per_byte = 8 / bits;
+	unsigned int mask = (1 << bits) - 1;
+	u32 acc = 0xFFFFFFFF;
+	u32 p = 0;
+
+	if(n >= MIN_BYTE_TABLE) {
+		/* 4 pixels for 2 bit texels, 2 and 2 unused for 4 bit ones */
+		u32 table[256][4];
+		u32 bytes = n / per_byte;
+		u32 i, k;
+
+		for(i = 0; i < 256; i++) {
+			for(k = 0; k < 4; k++)
+				table[i][k] = k < per_byte ? lut[(i >> (k * bits)) & mask] : 0xFFFFFFFF;
+		}
+
+#ifdef __SSE2__
+		__m128i vacc = _mm_set1_epi32(-1);
+		if(per_byte == 4) {
+			for(i = 0; i < bytes; i++) {
+				__m128i v = _mm_loadu_si128((const __m128i*) table[texels[i]]);
+				_mm_storeu_si128((__m128i*) (image + i * 4), v);
+				vacc = _mm_and_si128(vacc, v);
+			}
+		} else {
+			for(i = 0; i + 1 < bytes; i += 2) {
+				__m128i v = _mm_unpacklo_epi64(
+						_mm_loadl_epi64((const __m128i*) table[texels[i]]),
+						_mm_loadl_epi64((const __m128i*) table[texels[i + 1]]));
+				_mm_storeu_si128((__m128i*) (image + i * 2), v);
+				vacc = _mm_and_si128(vacc, v);
+			}
+			for(; i < bytes; i++) {
+				memcpy(image + i * 2, table[texels[i]], 8);
+				acc &= table[texels[i]][0] & table[texels[i]][1];
+			}
+		}
+		acc &= and_reduce(vacc);
+#else
+		for(i = 0; i < bytes; i++) {
+			const u32* px = table[texels[i]];
+			memcpy(image + i * per_byte, px, per_byte * 4);
+			acc &= px[0] & px[1] & px[2] & px[3];
+		}
+#endif
+		p = bytes * per_byte;
+	}
+
+	for(; p < n; p++) {
+		u32 index = (texels[p / per_byte] >> ((p % per_byte) * bits)) & mask;
+		image[p] = lut[index];
+		acc &= image[p];
+	}
+	return acc;
+}
+
+/* 16 bit little endian colours, the top bit is alpha */
+static u32 direct(u32* image, const u8* texels, u32 a0, u32 a1, u32 n)
+{
+	u32 acc = 0xFFFFFFFF;
+	u32 p = 0;
+
+#ifdef __SSE2__
+	__m128i vacc = _mm_set1_epi32(-1);
+	__m128i zero = _mm_setzero_si128();
+	__m128i r_mask = _mm_set1_epi32(0x001F);
+	__m128i g_mask = _mm_set1_epi32(0x03E0);
+	__m128i b_mask = _mm_set1_epi32(0x7C00);
+	__m128i alpha0 = _mm_set1_epi32(a0 << 24);
+	__m128i alpha1 = _mm_set1_epi32(a1 << 24);
+	for(; p + 8 <= n; p += 8) {
+		__m128i col = _mm_loadu_si128((const __m128i*) (texels + p * 2));
+		__m128i c[2];
+		int k;
+		c[0] = _mm_unpacklo_epi16(col, zero);
+		c[1] = _mm_unpackhi_epi16(col, zero);
+		for(k = 0; k < 2; k++) {
+			__m128i set = _mm_srai_epi32(_mm_slli_epi32(c[k], 16), 31);
+			__m128i v = _mm_or_si128(
+					_mm_or_si128(_mm_slli_epi32(_mm_and_si128(c[k], r_mask), 3),
+						_mm_slli_epi32(_mm_and_si128(c[k], g_mask), 6)),
+					_mm_or_si128(_mm_slli_epi32(_mm_and_si128(c[k], b_mask), 9),
+						_mm_or_si128(_mm_and_si128(set, alpha1), _mm_andnot_si128(set, alpha0))));
+			_mm_storeu_si128((__m128i*) (image + p + k * 4), v);
+			vacc = _mm_and_si128(vacc, v);
+		}
+	}
+	acc = and_reduce(vacc);
+#endif
+
+	for(; p < n; p++) {
+		u16 col = (u16) texels[p * 2] | ((u16) texels[p * 2 + 1] << 8);
+		image[p] = RGB555(col) | ((col & 0x8000 ? a1 : a0) << 24);
+		acc &= image[p];
+	}
+	return acc;
+}
+
+/* the expanded palette of tex, 0 for formats without one */
+static unsigned int build_lut(u32* lut, const CTexture* tex, const CPalette* pal, unsigned int alpha, bool decal)
+{
+	float scale = alpha / 31.0;
+	u32 opaque = 0xFF * scale;
+	unsigned int i;
+
+	switch(tex->format) {
+		case 0:					// 2bit palettised
+		case 1:					// 4bit palettised
+		case 2: {				// 8bit palettised
+			unsigned int count = tex->format == 0 ? 4 : tex->format == 1 ? 16 : 256;
+			for(i = 0; i < count; i++) {
+				u32 a = (tex->opaque || decal || i) ? opaque : 0;
+				lut[i] = palette_color(pal, i) | (a << 24);
+			}
+			return count;
+		}
+		case 4:					// A5I3
+			for(i = 0; i < 256; i++) {
+				u32 a = decal ? opaque : (u32) ((tex->opaque ? 255.0 : (i >> 3) / 31.0 * 255.0) * scale);
+				lut[i] = palette_color(pal, i & 0x07) | (a << 24);
+			}
+			return 256;
+		case 6:					// A3I5
+			for(i = 0; i < 256; i++) {
+				u32 a = decal ? opaque : (u32) ((tex->opaque ? 255.0 : (i >> 5) / 7.0 * 255.0) * scale);
+				lut[i] = palette_color(pal, i & 0x1F) | (a << 24);
+			}
+			return 256;
+		default:
+			return 0;
+	}
+}
+
+bool TEXDecode(u32* image, const CTexture* tex, const CPalette* pal, unsigned int alpha, bool decal, bool* translucent)
+{
+	u32 n = tex->width * tex->height;
+	u32 lut[256];
+	u32 acc;
+
+	if(!tex->data)
+		return false;
+
+	if(tex->format == 5) {			// 16bit RGB
+		u32 opaque = 0xFF * (float) (alpha / 31.0);
+		acc = direct(image, tex->data, (tex->opaque || decal) ? opaque : 0, opaque, n);
+	} else if(build_lut(lut, tex, pal, alpha, decal)) {
+		if(tex->format == 0 || tex->format == 1)
+			acc = lookup_packed(image, tex->data, lut, n, tex->format == 0 ? 2 : 4);
+		else
+			acc = lookup8(image, tex->data, lut, n);
+	} else {
+		return false;
+	}
+
+	*translucent = (acc >> 24) != 0xFF;
+	return true;
+}
+
+bool TEXDecodeIndexed(u8* indices, u32* palette, const CTexture* tex, const CPalette* pal, unsigned int alpha, bool decal, bool* translucent)
+{
+	u32 n = tex->width * tex->height;
+	u32 acc = 0xFFFFFFFF;
+	unsigned int count;
+	u32 p;
+
+	if(!tex->data)
+		return false;
+
+	memset(palette, 0, 256 * sizeof(u32));
+	count = build_lut(palette, tex, pal, alpha, decal);
+	if(!count)
+		return false;
+
+	if(count == 256) {
+		memcpy(indices, tex->data, n);
+	} else {
+		unsigned int bits = tex->format == 0 ? 2 : 4;
+		unsigned int per_byte = 8 / bits;
+		for(p = 0; p < n; p++)
+			indices[p] = (tex->data[p / per_byte] >> ((p % per_byte) * bits)) & (count - 1);
+	}
+
+	for(p = 0; p < n; p++)
+		acc &= palette[indices[p]];
+
+	*translucent = (acc >> 24) != 0xFF;
+	return true;
+}
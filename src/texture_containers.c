@@ -39,8 +39,9 @@ void load_texture_container(CModel* model, SHARED_TEXTURE id)
 {
 	if(!texture_containers[id]) {
 		printf("Loading texture container %s\n", texture_container_names[id]);
-		load_model(&texture_containers[id], texture_container_names[id], 0);
-		if(texture_containers[id]->dlists)
+		/* only the texels and palettes are used, nothing to upload */
+		parse_model(&texture_containers[id], texture_container_names[id], 0);
+		if(texture_containers[id]->num_dlists)
 			OS_Terminate();
 	}
 
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "error.h"
+#include "heap.h"
+#include "worker.h"
+
+#define MAX_WORKERS	4
+
+struct Job {
+	Job*	next;
+	JobFunc	func;
+	void*	arg;
+	int	done;
+};
+
+static pthread_t workers[MAX_WORKERS];
+static int worker_count = 0;
+static int shutting_down = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static Job* queue_head = NULL;
+static Job* queue_tail = NULL;
+
+static int cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	return (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+static void* worker_main(void* unused)
+{
+	Job* job;
+
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(!queue_head && !shutting_down)
+			pthread_cond_wait(&job_queued, &lock);
+		if(!queue_head)
+			break;
+
+		job = queue_head;
+		queue_head = job->next;
+		if(!queue_head)
+			queue_tail = NULL;
+		pthread_mutex_unlock(&lock);
+
+		job->func(job->arg);
+
+		pthread_mutex_lock(&lock);
+		job->done = 1;
+		pthread_cond_broadcast(&job_done);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static void start_workers(void)
+{
+	int i;
+	int count = cpu_count();
+
+	if(count > MAX_WORKERS)
+		count = MAX_WORKERS;
+	if(count < 1)
+		count = 1;
+
+	shutting_down = 0;
+	for(i = 0; i < count; i++) {
+		if(pthread_create(&workers[i], NULL, worker_main, NULL))
+			fatal_error("WorkerSubmit: Cannot create worker thread!\n");
+	}
+	worker_count = count;
+	printf("started %d worker threads\n", count);
+}
+
+Job* WorkerSubmit(JobFunc func, void* arg)
+{
+	Job* job = (Job*) alloc_from_heap(sizeof(Job));
+	if(!job)
+		fatal_error("WorkerSubmit: Not enough memory!\n");
+	job->next = NULL;
+	job->func = func;
+	job->arg = arg;
+	job->done = 0;
+
+	if(!worker_count)
+		start_workers();
+
+	pthread_mutex_lock(&lock);
+	if(queue_tail)
+		queue_tail->next = job;
+	else
+		queue_head = job;
+	queue_tail = job;
+	pthread_cond_signal(&job_queued);
+	pthread_mutex_unlock(&lock);
+
+	return job;
+}
+
+int WorkerDone(Job* job)
+{
+	int done;
+
+	pthread_mutex_lock(&lock);
+	done = job->done;
+	pthread_mutex_unlock(&lock);
+
+	return done;
+}
+
+void WorkerWait(Job* job)
+{
+	pthread_mutex_lock(&lock);
+	while(!job->done)
+		pthread_cond_wait(&job_done, &lock);
+	pthread_mutex_unlock(&lock);
+
+	free_to_heap(job);
+}
+
+void WorkerShutdown(void)
+{
+	int i;
+
+	if(!worker_count)
+		return;
+
+	pthread_mutex_lock(&lock);
+	shutting_down = 1;
+	pthread_cond_broadcast(&job_queued);
+	pthread_mutex_unlock(&lock);
+
+	for(i = 0; i < worker_count; i++)
+		pthread_join(workers[i], NULL);
+	worker_count = 0;
+}
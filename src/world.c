@@ -2,6 +2,7 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <float.h>
 
 #include "types.h"
 #include "strings.h"
@@ -10,6 +11,11 @@
 #include "game.h"
 #include "world.h"
 #include "heap.h"
+#include "error.h"
+#include "mtx.h"
+#include "model.h"
+#include "entity.h"
+#include "cull.h"
 
 CPortal* portals = NULL;
 int portal_count = 0;
@@ -83,3 +89,194 @@ const char* get_room_name(int room_id)
 	}
 	return NULL;
 }
+
+/*
+
+	Cell portals
+
+	The rm nodes of a room model are its cells. Each alimbic door standing
+	between two of them becomes a portal: the door model's box in world
+	space, with the cells picked by what contains a point just in front
+	of and just behind the door. Doors are treated as always open.
+
+*/
+
+#define	MAX_PORTAL_DEPTH	16
+
+static bool contains(const float bounds[3][2], const float p[3])
+{
+	int i;
+	for(i = 0; i < 3; i++) {
+		if(p[i] < bounds[i][0] || p[i] > bounds[i][1])
+			return false;
+	}
+	return true;
+}
+
+static float volume(const float bounds[3][2])
+{
+	return (bounds[0][1] - bounds[0][0]) * (bounds[1][1] - bounds[1][0]) * (bounds[2][1] - bounds[2][0]);
+}
+
+/* the smallest cell containing pos, -1 if none does */
+int WORLDFindCell(CRoom* room, const float pos[3])
+{
+	int i;
+	int cell = -1;
+	float best = FLT_MAX;
+
+	for(i = 0; i < room->num_cells; i++) {
+		float v;
+		if(!contains(room->cells[i].bounds, pos))
+			continue;
+		v = volume(room->cells[i].bounds);
+		if(v < best) {
+			best = v;
+			cell = i;
+		}
+	}
+	return cell;
+}
+
+static void door_bounds(CAlimbicDoor* door, float bounds[3][2], int* axis)
+{
+	CModel* model = door->model;
+	float local[3][2] = { { model->min_x, model->max_x }, { model->min_y, model->max_y }, { model->min_z, model->max_z } };
+	float size[3];
+	Mtx44 scale, mtx;
+	int i;
+
+	MTX44Scale(&scale, model->scale, model->scale, model->scale);
+	MTX44Concat(&door->transform, &scale, &mtx);
+	MTX44TransformBounds(&mtx, local, bounds);
+
+	/* the door is thinnest along the way through it */
+	for(i = 0; i < 3; i++)
+		size[i] = bounds[i][1] - bounds[i][0];
+	*axis = size[0] < size[1] ? (size[0] < size[2] ? 0 : 2) : (size[1] < size[2] ? 1 : 2);
+}
+
+void WORLDBuildCellPortals(CRoom* room)
+{
+	CEntity* ent;
+	int max_portals = 0;
+
+	room->portals = NULL;
+	room->num_portals = 0;
+
+	for(ent = CEntity_get_instances(ALIMBIC_DOOR); ent; ent = ent->next)
+		max_portals++;
+	if(!max_portals || room->num_cells < 2)
+		return;
+
+	room->portals = (CCellPortal*) malloc(max_portals * sizeof(CCellPortal));
+	if(!room->portals)
+		fatal_error("WORLDBuildCellPortals: Not enough memory!\n");
+
+	for(ent = CEntity_get_instances(ALIMBIC_DOOR); ent; ent = ent->next) {
+		CAlimbicDoor* door = (CAlimbicDoor*) ent;
+		CCellPortal* portal;
+		float bounds[3][2];
+		float front[3], back[3];
+		int axis, i, a, b;
+
+		if(!door->model)
+			continue;
+
+		door_bounds(door, bounds, &axis);
+		for(i = 0; i < 3; i++)
+			front[i] = back[i] = (bounds[i][0] + bounds[i][1]) * 0.5f;
+		front[axis] = bounds[axis][1] + 1.0f;
+		back[axis] = bounds[axis][0] - 1.0f;
+
+		a = WORLDFindCell(room, front);
+		b = WORLDFindCell(room, back);
+		if(a == -1 || b == -1 || a == b)
+			continue;
+
+		portal = &room->portals[room->num_portals++];
+		portal->cells[0] = a;
+		portal->cells[1] = b;
+		memcpy(portal->bounds, bounds, sizeof(bounds));
+		room->cells[a].num_portals++;
+		room->cells[b].num_portals++;
+	}
+
+	printf("portals: %d cells, %d portals\n", room->num_cells, room->num_portals);
+}
+
+static void visit_cell(CRoom* room, int cell, const float rect[4], int* path, int depth)
+{
+	int i, j;
+
+	room->cells[cell].visible = true;
+	if(depth == MAX_PORTAL_DEPTH)
+		return;
+	path[depth] = cell;
+
+	for(i = 0; i < room->num_portals; i++) {
+		CCellPortal* portal = &room->portals[i];
+		float r[4];
+		int next;
+
+		if(portal->cells[0] == cell)
+			next = portal->cells[1];
+		else if(portal->cells[1] == cell)
+			next = portal->cells[0];
+		else
+			continue;
+
+		/* no cycles */
+		for(j = 0; j <= depth && path[j] != next; j++)
+			;
+		if(j <= depth)
+			continue;
+
+		if(!CULLTestBounds(portal->bounds))
+			continue;
+
+		/* what of the portal is still seen through the portals before it */
+		CULLProjectBounds(portal->bounds, r);
+		r[0] = r[0] > rect[0] ? r[0] : rect[0];
+		r[1] = r[1] > rect[1] ? r[1] : rect[1];
+		r[2] = r[2] < rect[2] ? r[2] : rect[2];
+		r[3] = r[3] < rect[3] ? r[3] : rect[3];
+		if(r[0] >= r[2] || r[1] >= r[3])
+			continue;
+
+		visit_cell(room, next, r, path, depth + 1);
+	}
+}
+
+/* marks the cells seen from eye through the portals, all of them with
+   frustum culling off or the eye outside the portal graph; cells no door
+   connects are always visible. Cell boxes overlap around doorways, so the
+   search starts from every cell whose box holds the eye */
+void WORLDFindVisibleCells(CRoom* room, const float eye[3])
+{
+	float rect[4] = { -1.0f, -1.0f, 1.0f, 1.0f };
+	int path[MAX_PORTAL_DEPTH];
+	bool all = !frustum_culling;
+	int starts = 0;
+	int i;
+
+	for(i = 0; !all && i < room->num_cells; i++) {
+		if(!contains(room->cells[i].bounds, eye))
+			continue;
+		starts++;
+		if(!room->cells[i].num_portals)
+			all = true;
+	}
+	if(!starts)
+		all = true;
+
+	for(i = 0; i < room->num_cells; i++)
+		room->cells[i].visible = all || !room->cells[i].num_portals;
+	if(all)
+		return;
+
+	for(i = 0; i < room->num_cells; i++) {
+		if(contains(room->cells[i].bounds, eye))
+			visit_cell(room, i, rect, path, 0);
+	}
+}
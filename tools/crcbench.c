@@ -0,0 +1,265 @@
+/*
+
+	CRC-32 benchmark
+
+	Hashes the texels of every texture and every palette of every model
+	given on the command line, as material_key does, with the old bit at
+	a time loop, the slice-by-8 tables and the PCLMULQDQ folding, checks
+	that all agree and prints the throughput of each. Models with their
+	textures in a separate file (the rooms) are given as model.bin,tex.bin.
+
+	gcc -O3 -o crcbench -iquote include tools/crcbench.c src/hash.c -lpthread
+	./crcbench data/models/<name>_Model.bin data/levels/models/unit1_Land_Model.bin,data/levels/models/unit1_Land_Tex.bin ...
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "types.h"
+#include "endianess.h"
+#include "hash.h"
+
+/* the parts of the model file layout this needs, see model.c */
+typedef struct {
+	u16		format;
+	u16		width;
+	u16		height;
+	u16		pad;
+	u32		image_ofs;
+	u32		imagesize;
+	u32		dunno1;
+	u32		dunno2;
+	u32		vram_offset;
+	u32		opaque;
+	u32		some_value;
+	u8		packed_size;
+	u8		native_texture_format;
+	u16		texture_obj_ref;
+} Texture;
+
+typedef struct {
+	u32		entries_ofs;
+	u32		count;
+	u32		dunno1;
+	u32		some_reference;
+} Palette;
+
+typedef struct {
+	u32		modelview_mtx_shamt;
+	s32		scale;
+	u32		unk3;
+	u32		unk4;
+	u32		materials;
+	u32		dlists;
+	u32		nodes;
+	u16		num_node_weight;
+	u8		flags;
+	u8		field_1F;
+	u32		node_weights;
+	u32		meshes;
+	u16		num_textures;
+	u16		field_2A;
+	u32		textures;
+	u16		num_palettes;
+	u16		field_32;
+	u32		palettes;
+} __attribute__((__packed__)) HEADER;
+
+typedef struct {
+	const u8*	data;
+	u32		size;
+} Block;
+
+typedef u32 (*CRCFunc)(const u8* data, u32 len);
+
+/* the crc32 the hash module replaced, kept as a reference */
+static u32 crc32_ref(const u8* data, u32 len)
+{
+	int j;
+	unsigned int crc = 0xFFFFFFFF, mask;
+
+	while(len--) {
+		crc = crc ^ *(data++);
+		for (j = 7; j >= 0; j--) {
+			mask = -(crc & 1);
+			crc = (crc >> 1) ^ (0xEDB88320 & mask);
+		}
+	}
+	return ~crc;
+}
+
+static u32 crc32_tables(const u8* data, u32 len)
+{
+	return crc32_table(0, data, len);
+}
+
+static u32 crc32_folded(const u8* data, u32 len)
+{
+	return crc32_clmul(0, data, len);
+}
+
+static double now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static u8* read_file(const char* path, u32* size)
+{
+	FILE* f = fopen(path, "rb");
+	u8* data;
+	if(!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = (u8*) malloc(*size);
+	if(fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+/* the texels of each texture and the entries of each palette */
+static unsigned int collect_blocks(Block* blocks, unsigned int max_blocks, u8* model, u32 model_size, u8* textures, u32 texture_size)
+{
+	HEADER* header = (HEADER*) model;
+	u32 texture_ofs = get32bit_LE((u8*)&header->textures);
+	u32 palette_ofs = get32bit_LE((u8*)&header->palettes);
+	unsigned int num_textures = get16bit_LE((u8*)&header->num_textures);
+	unsigned int num_palettes = get16bit_LE((u8*)&header->num_palettes);
+	unsigned int i, count = 0;
+
+	if(model_size < sizeof(HEADER))
+		return 0;
+
+	for(i = 0; texture_ofs && i < num_textures && count < max_blocks; i++) {
+		Texture* t = (Texture*) (model + texture_ofs + i * sizeof(Texture));
+		u32 ofs = get32bit_LE((u8*)&t->image_ofs);
+		u32 format = get16bit_LE((u8*)&t->format);
+		u32 size = get16bit_LE((u8*)&t->width) * get16bit_LE((u8*)&t->height);
+		size = format == 0 ? size / 4 : format == 1 ? size / 2 : format == 5 ? size * 2 : size;
+		if(ofs + size > texture_size)
+			continue;
+		blocks[count].data = textures + ofs;
+		blocks[count].size = size;
+		count++;
+	}
+
+	for(i = 0; palette_ofs && i < num_palettes && count < max_blocks; i++) {
+		Palette* p = (Palette*) (model + palette_ofs + i * sizeof(Palette));
+		u32 ofs = get32bit_LE((u8*)&p->entries_ofs);
+		u32 size = get32bit_LE((u8*)&p->count);
+		if(ofs + size > texture_size)
+			continue;
+		blocks[count].data = textures + ofs;
+		blocks[count].size = size;
+		count++;
+	}
+
+	return count;
+}
+
+static double run(CRCFunc f, const Block* blocks, unsigned int num_blocks, int iterations, u32* sum)
+{
+	double t0 = now();
+	unsigned int j;
+	int k;
+
+	*sum = 0;
+	for(k = 0; k < iterations; k++) {
+		for(j = 0; j < num_blocks; j++)
+			*sum += f(blocks[j].data, blocks[j].size);
+	}
+	return (now() - t0) / iterations;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int max_blocks = 65536;
+	Block* blocks = (Block*) malloc(max_blocks * sizeof(Block));
+	unsigned int num_blocks = 0;
+	unsigned int mismatches = 0;
+	double bytes = 0, t_ref, t_table, t_clmul;
+	u32 sum_ref, sum_table, sum_clmul;
+	int iterations = 20;
+	int i;
+	unsigned int j;
+
+	if(argc < 2) {
+		printf("usage: %s model.bin[,tex.bin] ...\n", argv[0]);
+		return 1;
+	}
+
+	for(i = 1; i < argc; i++) {
+		char path[1024];
+		char* comma;
+		u32 model_size, texture_size;
+		u8* model;
+		u8* textures;
+
+		strncpy(path, argv[i], sizeof(path) - 1);
+		path[sizeof(path) - 1] = 0;
+		comma = strchr(path, ',');
+		if(comma)
+			*comma = 0;
+
+		model = read_file(path, &model_size);
+		if(!model) {
+			printf("%s: cannot read\n", path);
+			continue;
+		}
+		textures = model;
+		texture_size = model_size;
+		if(comma) {
+			textures = read_file(comma + 1, &texture_size);
+			if(!textures) {
+				printf("%s: cannot read\n", comma + 1);
+				continue;
+			}
+		}
+
+		num_blocks += collect_blocks(blocks + num_blocks, max_blocks - num_blocks, model, model_size, textures, texture_size);
+	}
+
+	for(j = 0; j < num_blocks; j++) {
+		u32 ref = crc32_ref(blocks[j].data, blocks[j].size);
+		if(crc32_tables(blocks[j].data, blocks[j].size) != ref || crc32_folded(blocks[j].data, blocks[j].size) != ref) {
+			printf("block %u (%u bytes): MISMATCH\n", j, blocks[j].size);
+			mismatches++;
+		}
+		bytes += blocks[j].size;
+	}
+
+	t_ref = run(crc32_ref, blocks, num_blocks, iterations, &sum_ref);
+	t_table = run(crc32_tables, blocks, num_blocks, iterations, &sum_table);
+	t_clmul = run(crc32_folded, blocks, num_blocks, iterations, &sum_clmul);
+
+	printf("%u blocks, %.0f bytes, %u mismatches, PCLMULQDQ %s\n", num_blocks, bytes, mismatches, crc32_clmul_supported() ? "used" : "not supported");
+	if(t_table > 0 && t_clmul > 0) {
+		printf("ref %.1f MB/s, slice-by-8 %.1f MB/s (%.2fx), folded %.1f MB/s (%.2fx)\n",
+				bytes / t_ref / 1e6,
+				bytes / t_table / 1e6, t_ref / t_table,
+				bytes / t_clmul / 1e6, t_ref / t_clmul);
+	}
+
+	return mismatches != 0 || sum_ref != sum_table || sum_ref != sum_clmul;
+}
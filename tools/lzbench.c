@@ -0,0 +1,189 @@
+/*
+
+	LZ10 decoder benchmark
+
+	Decodes every file given on the command line with the old ring buffer
+	decoder and with LZDecode, checks that both produce the same output and
+	prints the throughput of each.
+
+	gcc -O3 -o lzbench -iquote include tools/lzbench.c src/lzss.c src/heap.c src/error.c
+	./lzbench data/archives/<name>.arc ...
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "types.h"
+#include "heap.h"
+#include "lzss.h"
+
+#define N		 4096	/* size of ring buffer */
+#define F		   18	/* upper limit for match_length */
+#define THRESHOLD	    2   /* encode string into position and length if match_length is greater than this */
+
+/* the decoder LZDecode replaced, kept as a reference */
+static int LZDecode_ref(void** output, void* input)
+{
+	unsigned char text_buf[N + F - 1];
+
+	int  i, j, k, r, c, z;
+	unsigned int flags;
+	u32 decomp_size;
+	u32 cur_size = 0;
+	u8* in = (u8*) input;
+	u8* out;
+
+	// read gba header info
+	u32 gbaheader;
+	for(i = 0; i < 4; i++)
+		gbaheader = (gbaheader >> 8) | (*(in++) << 24);
+	decomp_size = gbaheader >> 8;
+
+	out = (u8*) alloc_from_heap(decomp_size);
+	*output = out;
+
+	for(i = 0; i < N - F; i++)
+		text_buf[i] = 0xFF;
+	r = N - F;
+	flags = z = 7;
+	while(cur_size < decomp_size) {
+		flags <<= 1;
+		z++;
+		if (z == 8) {				// read new block flag
+			c = *(in++);
+			flags = c;
+			z = 0;				// reset counter
+		}
+		if(!(flags & 0x80)) {			// flag bit zero => uncompressed
+			c = *(in++);
+			if(cur_size < decomp_size)
+				*(out++) = c;
+			text_buf[r++] = c;
+			r &= N - 1;
+			cur_size++;
+		} else {
+			i = *(in++);
+			j = *(in++);
+			j = j | ((i << 8) & 0xf00);		// match offset
+			i = ((i >> 4) & 0x0f) + THRESHOLD;	// match length
+			for (k = 0; k <= i; k++) {
+				c = text_buf[(r - j - 1) & (N - 1)];
+				if(cur_size < decomp_size)
+					*(out++) = c;
+				text_buf[r++] = c;
+				r &= N - 1;
+				cur_size++;
+			}
+		}
+	}
+
+	return decomp_size;
+}
+
+static double now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static u8* read_file(const char* path, int* size)
+{
+	FILE* f = fopen(path, "rb");
+	u8* data;
+	if(!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = (u8*) malloc(*size);
+	if(fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+int main(int argc, char** argv)
+{
+	int i, j;
+	int iterations = 20;
+	double total_ref = 0, total_new = 0;
+	double total_bytes = 0;
+
+	if(argc < 2) {
+		printf("usage: %s file.arc [file.arc ...]\n", argv[0]);
+		return 1;
+	}
+
+	for(i = 1; i < argc; i++) {
+		int size, out_size;
+		void* ref;
+		void* out;
+		double t0, t_ref, t_new;
+		u8* data = read_file(argv[i], &size);
+		if(!data) {
+			printf("%s: cannot read\n", argv[i]);
+			continue;
+		}
+		if(size < 4 || data[0] != 0x10) {
+			printf("%s: not LZ10 compressed, skipped\n", argv[i]);
+			free(data);
+			continue;
+		}
+
+		out_size = LZDecode_ref(&ref, data);
+		LZDecode(&out, data, size);
+		if(memcmp(ref, out, out_size)) {
+			printf("%s: MISMATCH\n", argv[i]);
+			return 1;
+		}
+		free_to_heap(ref);
+		free_to_heap(out);
+
+		t0 = now();
+		for(j = 0; j < iterations; j++) {
+			LZDecode_ref(&ref, data);
+			free_to_heap(ref);
+		}
+		t_ref = (now() - t0) / iterations;
+
+		t0 = now();
+		for(j = 0; j < iterations; j++) {
+			LZDecode(&out, data, size);
+			free_to_heap(out);
+		}
+		t_new = (now() - t0) / iterations;
+
+		printf("%-32s %8d -> %8d bytes  ref %7.1f MB/s  new %7.1f MB/s  (%.2fx)\n",
+				argv[i], size, out_size,
+				out_size / t_ref / 1e6, out_size / t_new / 1e6, t_ref / t_new);
+
+		total_ref += t_ref;
+		total_new += t_new;
+		total_bytes += out_size;
+		free(data);
+	}
+
+	if(total_new > 0)
+		printf("total: ref %.1f MB/s, new %.1f MB/s (%.2fx)\n",
+				total_bytes / total_ref / 1e6, total_bytes / total_new / 1e6, total_ref / total_new);
+
+	return 0;
+}
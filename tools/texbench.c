@@ -0,0 +1,391 @@
+/*
+
+	Texture decoder benchmark
+
+	Decodes the texture of every material of every model given on the
+	command line with the old per texel decoder and with TEXDecode, checks
+	that both produce the same image and translucency and prints the
+	throughput of each. Models with their textures in a separate file
+	(the rooms) are given as model.bin,tex.bin.
+
+	gcc -O3 -o texbench -iquote include tools/texbench.c src/texdecode.c
+	./texbench data/models/<name>_Model.bin data/levels/models/unit1_Land_Model.bin,data/levels/models/unit1_Land_Tex.bin ...
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "types.h"
+#include "endianess.h"
+#include "model.h"
+#include "texdecode.h"
+
+/* the parts of the model file layout this needs, see model.c */
+typedef struct {
+	u8		name[64];
+	u8		light;
+	u8		culling;
+	u8		alpha;
+	u8		wireframe;
+	u16		palid;
+	u16		texid;
+	u8		x_repeat;
+	u8		y_repeat;
+	Color3		diffuse;
+	Color3		ambient;
+	Color3		specular;
+	u8		field_53;
+	u32		polygon_mode;
+} Material;
+
+typedef struct {
+	u16		format;
+	u16		width;
+	u16		height;
+	u16		pad;
+	u32		image_ofs;
+	u32		imagesize;
+	u32		dunno1;
+	u32		dunno2;
+	u32		vram_offset;
+	u32		opaque;
+	u32		some_value;
+	u8		packed_size;
+	u8		native_texture_format;
+	u16		texture_obj_ref;
+} Texture;
+
+typedef struct {
+	u32		entries_ofs;
+	u32		count;
+	u32		dunno1;
+	u32		some_reference;
+} Palette;
+
+typedef struct {
+	u32		modelview_mtx_shamt;
+	s32		scale;
+	u32		unk3;
+	u32		unk4;
+	u32		materials;
+	u32		dlists;
+	u32		nodes;
+	u16		num_node_weight;
+	u8		flags;
+	u8		field_1F;
+	u32		node_weights;
+	u32		meshes;
+	u16		num_textures;
+	u16		field_2A;
+	u32		textures;
+	u16		num_palettes;
+	u16		field_32;
+	u32		palettes;
+	u32		some_anim_counts;
+	u32		unk8;
+	u32		node_initial_pos;
+	u32		node_pos;
+	u16		num_materials;
+} __attribute__((__packed__)) HEADER;
+
+/* sizeof the full model.c Material */
+#define MATERIAL_SIZE	0x84
+
+#define GX_POLYGONMODE_DECAL	1
+
+typedef struct {
+	CTexture	tex;
+	CPalette	pal;
+	unsigned int	alpha;
+	bool		decal;
+} Job;
+
+/* the decoder TEXDecode replaced, kept as a reference */
+static bool decode_ref(u32* image, const CTexture* tex, const CPalette* pal, unsigned int mat_alpha, bool decal)
+{
+	u8* texels = tex->data;
+	u16* paxels = pal->data;
+	u32 num_pixels = (u32)tex->width * (u32)tex->height;
+	float alpha = mat_alpha / 31.0;
+	u32 p;
+
+	if(tex->format == 0) {				// 2bit palettised
+		for(p = 0; p < num_pixels; p++) {
+			u32 index = texels[p / 4];
+			index = (index >> ((p % 4) * 2)) & 0x3;
+			u16 col = get16bit_LE((u8*)&paxels[index]);
+			u32 r = ((col >>  0) & 0x1F) << 3;
+			u32 g = ((col >>  5) & 0x1F) << 3;
+			u32 b = ((col >> 10) & 0x1F) << 3;
+			u32 a = (tex->opaque ? 0xFF : (index == 0 ? 0x00 : 0xFF)) * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	} else if(tex->format == 1) {			// 4bit palettised
+		for(p = 0; p < num_pixels; p++) {
+			u32 index = texels[p / 2];
+			index = (index >> ((p % 2) * 4)) & 0xF;
+			u16 col = get16bit_LE((u8*)&paxels[index]);
+			u32 r = ((col >>  0) & 0x1F) << 3;
+			u32 g = ((col >>  5) & 0x1F) << 3;
+			u32 b = ((col >> 10) & 0x1F) << 3;
+			u32 a = (tex->opaque ? 0xFF : (index == 0 ? 0x00 : 0xFF)) * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	} else if(tex->format == 2) {			// 8bit palettised
+		for(p = 0; p < num_pixels; p++) {
+			u32 index = texels[p];
+			u16 col = get16bit_LE((u8*)&paxels[index]);
+			u32 r = ((col >>  0) & 0x1F) << 3;
+			u32 g = ((col >>  5) & 0x1F) << 3;
+			u32 b = ((col >> 10) & 0x1F) << 3;
+			u32 a = (tex->opaque ? 0xFF : (index == 0 ? 0x00 : 0xFF)) * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	} else if(tex->format == 4) {			// A5I3
+		for(p = 0; p < num_pixels; p++) {
+			u8 entry = texels[p];
+			u8 i = (entry & 0x07);
+			u16 col = get16bit_LE((u8*)&paxels[i]);
+			u32 r = ((col >>  0) & 0x1F) << 3;
+			u32 g = ((col >>  5) & 0x1F) << 3;
+			u32 b = ((col >> 10) & 0x1F) << 3;
+			u32 a = (tex->opaque ? 0xFF : ((entry >> 3) / 31.0 * 255.0)) * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	} else if(tex->format == 5) {			// 16it RGB
+		for(p = 0; p < num_pixels; p++) {
+			u16 col = (u16)texels[p * 2 + 0] | (((u16)texels[p * 2 + 1]) << 8);
+			u32 r = ((col >> 0) & 0x1F) << 3;
+			u32 g = ((col >> 5) & 0x1F) << 3;
+			u32 b = ((col >> 10) & 0x1F) << 3;
+			u32 a = (tex->opaque ? 0xFF : ((col & 0x8000) ? 0xFF : 0x00)) * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	} else if(tex->format == 6) {			// A3I5
+		for(p = 0; p < num_pixels; p++) {
+			u8 entry = texels[p];
+			u32 i = entry & 0x1F;
+			u16 col = get16bit_LE((u8*)&paxels[i]);
+			u32 r = ((col >>  0) & 0x1F) << 3;
+			u32 g = ((col >>  5) & 0x1F) << 3;
+			u32 b = ((col >> 10) & 0x1F) << 3;
+			u32 a = (tex->opaque ? 0xFF : ((entry >> 5) / 7.0 * 255.0)) * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	}
+
+	if(decal) {
+		for(p = 0; p < num_pixels; p++) {
+			u32 col = image[p];
+			u32 r = (col >>  0) & 0xFF;
+			u32 g = (col >>  8) & 0xFF;
+			u32 b = (col >> 16) & 0xFF;
+			u32 a = 0xFF * alpha;
+			image[p] = (r << 0) | (g << 8) | (b << 16) | (a << 24);
+		}
+	}
+
+	for(p = 0; p < num_pixels; p++) {
+		if(((image[p] >> 24) & 0xFF) != 0xFF)
+			return true;
+	}
+	return false;
+}
+
+static double now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static u8* read_file(const char* path, u32* size)
+{
+	FILE* f = fopen(path, "rb");
+	u8* data;
+	if(!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = (u8*) malloc(*size);
+	if(fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+/* one job per material with a texture the reference decoder can read safely */
+static unsigned int collect_jobs(Job* jobs, unsigned int max_jobs, u8* model, u32 model_size, u8* textures, u32 texture_size)
+{
+	HEADER* header = (HEADER*) model;
+	u32 materials = get32bit_LE((u8*)&header->materials);
+	u32 texture_ofs = get32bit_LE((u8*)&header->textures);
+	u32 palette_ofs = get32bit_LE((u8*)&header->palettes);
+	unsigned int num_materials = get16bit_LE((u8*)&header->num_materials);
+	unsigned int num_textures = get16bit_LE((u8*)&header->num_textures);
+	unsigned int num_palettes = get16bit_LE((u8*)&header->num_palettes);
+	unsigned int i, j, count = 0;
+
+	if(model_size < sizeof(HEADER) || !materials || !texture_ofs)
+		return 0;
+
+	for(i = 0; i < num_materials && count < max_jobs; i++) {
+		Material* mat = (Material*) (model + materials + i * MATERIAL_SIZE);
+		u16 texid = get16bit_LE((u8*)&mat->texid);
+		u16 palid = get16bit_LE((u8*)&mat->palid);
+		Texture* t;
+		Job* job;
+		u32 ofs, texel_size, needed;
+
+		if(texid == 0xFFFF || texid >= num_textures)
+			continue;
+
+		t = (Texture*) (model + texture_ofs + texid * sizeof(Texture));
+		job = &jobs[count];
+		job->tex.format = get16bit_LE((u8*)&t->format);
+		job->tex.width = get16bit_LE((u8*)&t->width);
+		job->tex.height = get16bit_LE((u8*)&t->height);
+		job->tex.opaque = t->opaque;
+		job->tex.size = get32bit_LE((u8*)&t->imagesize);
+		job->alpha = mat->alpha;
+		job->decal = get32bit_LE((u8*)&mat->polygon_mode) == GX_POLYGONMODE_DECAL;
+
+		ofs = get32bit_LE((u8*)&t->image_ofs);
+		texel_size = job->tex.format == 0 ? 2 : job->tex.format == 1 ? 4 : job->tex.format == 5 ? 16 : 8;
+		needed = (job->tex.width * job->tex.height * texel_size + 7) / 8;
+		if(job->tex.format == 3 || job->tex.format > 6 || ofs + needed > texture_size)
+			continue;
+		job->tex.data = textures + ofs;
+
+		/* the reference decoder reads the palette unchecked, give it a full one */
+		job->pal.size = 512;
+		job->pal.data = (u16*) calloc(256, sizeof(u16));
+		if(job->tex.format != 5) {
+			Palette* p;
+			u32 entries, size;
+			if(palid == 0xFFFF || palid >= num_palettes || !palette_ofs) {
+				free(job->pal.data);
+				continue;
+			}
+			p = (Palette*) (model + palette_ofs + palid * sizeof(Palette));
+			entries = get32bit_LE((u8*)&p->entries_ofs);
+			size = get32bit_LE((u8*)&p->count);
+			if(size > 512)
+				size = 512;
+			for(j = 0; j < size / 2 && entries + j * 2 + 1 < texture_size; j++)
+				job->pal.data[j] = get16bit_LE(textures + entries + j * 2);
+		}
+		count++;
+	}
+
+	return count;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int max_jobs = 65536;
+	Job* jobs = (Job*) malloc(max_jobs * sizeof(Job));
+	unsigned int num_jobs = 0;
+	u32* ref;
+	u32* out;
+	double t0, t_ref, t_new, pixels = 0;
+	unsigned int mismatches = 0;
+	int iterations = 20;
+	int i, k;
+	unsigned int j;
+
+	if(argc < 2) {
+		printf("usage: %s model.bin[,tex.bin] ...\n", argv[0]);
+		return 1;
+	}
+
+	for(i = 1; i < argc; i++) {
+		char path[1024];
+		char* comma;
+		u32 model_size, texture_size;
+		u8* model;
+		u8* textures;
+
+		strncpy(path, argv[i], sizeof(path) - 1);
+		path[sizeof(path) - 1] = 0;
+		comma = strchr(path, ',');
+		if(comma)
+			*comma = 0;
+
+		model = read_file(path, &model_size);
+		if(!model) {
+			printf("%s: cannot read\n", path);
+			continue;
+		}
+		textures = model;
+		texture_size = model_size;
+		if(comma) {
+			textures = read_file(comma + 1, &texture_size);
+			if(!textures) {
+				printf("%s: cannot read\n", comma + 1);
+				continue;
+			}
+		}
+
+		num_jobs += collect_jobs(jobs + num_jobs, max_jobs - num_jobs, model, model_size, textures, texture_size);
+		/* the texel data stays in use */
+	}
+
+	ref = (u32*) malloc(1024 * 1024 * 4);
+	out = (u32*) malloc(1024 * 1024 * 4);
+
+	for(j = 0; j < num_jobs; j++) {
+		Job* job = &jobs[j];
+		u32 n = job->tex.width * job->tex.height;
+		bool ref_translucent, translucent;
+		if(n > 1024 * 1024)
+			continue;
+		ref_translucent = decode_ref(ref, &job->tex, &job->pal, job->alpha, job->decal);
+		TEXDecode(out, &job->tex, &job->pal, job->alpha, job->decal, &translucent);
+		if(memcmp(ref, out, n * 4) || ref_translucent != translucent) {
+			printf("texture %u (%ux%u format %u): MISMATCH\n", j, job->tex.width, job->tex.height, job->tex.format);
+			mismatches++;
+		}
+		pixels += n;
+	}
+
+	t0 = now();
+	for(k = 0; k < iterations; k++) {
+		for(j = 0; j < num_jobs; j++)
+			decode_ref(ref, &jobs[j].tex, &jobs[j].pal, jobs[j].alpha, jobs[j].decal);
+	}
+	t_ref = (now() - t0) / iterations;
+
+	t0 = now();
+	for(k = 0; k < iterations; k++) {
+		for(j = 0; j < num_jobs; j++) {
+			bool translucent;
+			TEXDecode(out, &jobs[j].tex, &jobs[j].pal, jobs[j].alpha, jobs[j].decal, &translucent);
+		}
+	}
+	t_new = (now() - t0) / iterations;
+
+	printf("%u textures, %.0f pixels, %u mismatches\n", num_jobs, pixels, mismatches);
+	if(t_new > 0)
+		printf("ref %.1f Mpixel/s, new %.1f Mpixel/s (%.2fx)\n", pixels / t_ref / 1e6, pixels / t_new / 1e6, t_ref / t_new);
+
+	return mismatches != 0;
+}